@@ -54,4 +54,19 @@ do { \
 #  define irq_set_irq_type set_irq_type
 #endif
 
+#if CONFIG_ACX_MAC80211_VERSION >= KERNEL_VERSION(5, 0, 0)
+/* v5.0 added the txq scheduler (ieee80211_next_txq), which the driver
+ * needs for pulling from the mac80211 intermediate tx queues, see
+ * acx_op_wake_tx_queue */
+#  define ACX_TXQ 1
+#else
+#  define ACX_TXQ 0
+#endif
+
+#if CONFIG_ACX_MAC80211_VERSION >= KERNEL_VERSION(5, 5, 0)
+#  define acx_return_txq(hw, txq) ieee80211_return_txq(hw, txq, false)
+#else
+#  define acx_return_txq(hw, txq) ieee80211_return_txq(hw, txq)
+#endif
+
 #endif /*  _ACX_COMPAT_H_ */
@@ -76,9 +76,6 @@
 /* if you want very experimental 802.11 power save mode features */
 #define POWER_SAVE_80211 0
 
-/* if you want very early packet fragmentation bits and pieces */
-#define ACX_FRAGMENTATION 0
-
 #ifdef OW_20100613_OBSELETE_ACXLOCK_REMOVE
 /* Locking: */
 /* very talkative */
@@ -73,6 +73,27 @@
 #define acx_sem_lock(adev)	mutex_lock(&(adev)->mutex)
 #define acx_sem_unlock(adev)	mutex_unlock(&(adev)->mutex)
 
+/*
+ * The tx_lock protects the hw_tx_queue[] ring state (head, tail,
+ * free) on PCI, where acx_op_tx may put a frame directly into a free
+ * descriptor without taking the sem.
+ *
+ * On mem the rings are already covered by the acx-spinlock (see
+ * acxmem_lock in inlines.h) and the tx path only runs under the sem,
+ * and on USB there are no descriptor rings, so it's a no-op there.
+ */
+#define acx_tx_lock(adev)					\
+	do {							\
+		if (IS_PCI(adev))				\
+			spin_lock_bh(&(adev)->tx_lock);		\
+	} while (0)
+
+#define acx_tx_unlock(adev)					\
+	do {							\
+		if (IS_PCI(adev))				\
+			spin_unlock_bh(&(adev)->tx_lock);	\
+	} while (0)
+
 /*
  * BOM Logging (Common)
  *
@@ -58,6 +58,13 @@ enum {
 
 extern unsigned int acx_hwcrypto;
 extern unsigned int acx_watchdog_enable;
+extern unsigned int acx_tx_ring_size;
+extern unsigned int acx_rx_ring_size;
+extern unsigned int acx_mem_block_size;
+extern unsigned int acx_mem_tx_percent;
+extern unsigned int acx_mem_frag_percent;
+extern unsigned int acx_mem_pool_auto;
+extern unsigned int acx_rate_control;
 
 /*
  * BOM Constants
@@ -130,6 +137,7 @@ extern unsigned int acx_watchdog_enable;
 /* BOM 'After Interrupt' Commands  */
 #define ACX_AFTER_IRQ_CMD_RADIO_RECALIB	0x01
 #define ACX_AFTER_IRQ_UPDATE_TIM	0x02
+#define ACX_AFTER_IRQ_UPDATE_RATE_FALLBACK	0x04
 
 /*
  * BOM  Tx/Rx buffer sizes and watermarks
@@ -141,9 +149,20 @@ extern unsigned int acx_watchdog_enable;
  * RX/TX_CNT=16 -> ~75k DMA buffers
  *
  * 2005-10-10: reduced memory usage by lowering both to 16
+ *
+ * These are the defaults only: the ring sizes in use are
+ * adev->rx_cnt and adev->tx_cnt, see the rx_ring_size and
+ * tx_ring_size module parameters. The acx111 memory config holds the
+ * descriptor counts in a u8.
  */
 #define RX_CNT 16
 #define TX_CNT 16
+#define ACX_MIN_RING_CNT 8
+#define ACX_MAX_RING_CNT 255
+
+/* Frame length histogram for the memory pool auto mode, 64 byte bins,
+ * see acx_mem_pool_pick_auto */
+#define ACX_POOL_HIST_BINS 40
 
 /* we clean up txdescs when we have N free txdesc: */
 #define TX_CLEAN_BACKLOG (TX_CNT/4)
@@ -154,7 +173,61 @@ extern unsigned int acx_watchdog_enable;
 /* we start queue if we have >= N free txbufs: */
 #define TX_START_QUEUE 5
 
-#define ACX_TX_QUEUE_MAX_LENGTH 20
+/* End of a block chain in acx_txbuf_next (acxmem) */
+#define ACX_TXBUF_END 0xffff
+
+/* Entries in the per-device rate tables (acx111 has the most) */
+#define ACX_MAX_RATES 12
+
+/* Tx attempts per rate before the firmware falls back to the next
+ * lower one of the rateset (ACX1xx_IE_RATE_FALLBACK) */
+#define ACX_RATE_FALLBACK_RETRIES 1
+
+/*
+ * Driver rate control (acx_rate_control=1), see acx_rc_update: every
+ * ACX_RC_INTERVAL, fold the success rate of each rate into an EWMA
+ * keeping ACX_RC_EWMA_LEVEL percent of the old value. One frame out
+ * of ACX_RC_SAMPLE_EVERY samples another rate. There is one table for
+ * the device, so it is for a single peer: station mode only.
+ */
+#define ACX_RC_INTERVAL (HZ / 10)
+#define ACX_RC_EWMA_LEVEL 75
+#define ACX_RC_SAMPLE_EVERY 10
+
+struct acx_rc_rate {
+	unsigned int	attempts;	/* in this interval */
+	unsigned int	success;
+	unsigned long	attempts_total;
+	unsigned long	success_total;
+	unsigned int	prob;		/* EWMA success, per mille */
+	unsigned int	tp;		/* expected throughput, 100kbps */
+};
+
+/* _acx_tx_data frag argument: position of the frame in a fragment
+ * train, see acx_tx_data_train */
+#define ACX_TX_FRAG_FIRST 0x01
+#define ACX_TX_FRAG_MORE 0x02
+#define ACX_TX_FRAG_SINGLE ACX_TX_FRAG_FIRST
+/* 4 bit fragment number */
+#define ACX_TX_MAX_FRAGS 16
+
+/*
+ * Tx backlog limit, see acx_tx_backlog_add(): the bytes accepted by
+ * acx_op_tx and not completed yet are bounded by an airtime budget
+ * between these limits (usecs), converted to bytes with the measured
+ * tx rate. Never less than two full sized frames.
+ */
+#define ACX_TX_BACKLOG_MIN_US 2000
+#define ACX_TX_BACKLOG_INIT_US 6000
+#define ACX_TX_BACKLOG_MAX_US 20000
+#define ACX_TX_BACKLOG_MIN_BYTES (2 * WLAN_DATA_MAXLEN)
+/* Period over which unused backlog (slack) is measured before
+ * shrinking the limit */
+#define ACX_TX_BACKLOG_SLACK_HOLD HZ
+/* Per-frame overhead, usecs: preamble, SIFS+ACK and the average
+ * contention window, for DSSS/CCK and OFDM rates */
+#define ACX_TX_DSSS_OVERHEAD_US 600
+#define ACX_TX_OFDM_OVERHEAD_US 180
 
 /*
  * BOM Global data
@@ -203,6 +276,10 @@ struct hw_tx_queue {
 	unsigned int head;
 	unsigned int tail;
 	unsigned int free;
+	/* Flow control, see acx_tx_stop_hw_tx_queues */
+	int stopped;
+	unsigned long stop_count;
+	unsigned long wake_count;
 
 	struct {
 		struct txacxdesc *start;
@@ -401,6 +478,65 @@ struct acx_device {
 	/* Mac80211 Tx_queue */
 	struct sk_buff_head tx_queue;
 	struct work_struct tx_work;
+	/* Short data-path lock for the hw_tx_queue[] rings, see acx_tx_lock */
+	spinlock_t		tx_lock;
+	/* Fragments held until their train is complete, per mac80211
+	 * queue, see acx_tx_fragment */
+	struct sk_buff_head tx_frags[IEEE80211_NUM_ACS];
+	/* Doorbell coalescing, see acx_tx_queue_go */
+	int		tx_batching;
+	unsigned int	tx_batch_pending;
+	/* Tx statistics, shown in debugfs tx_stats */
+	struct {
+		unsigned long	doorbells;
+		unsigned long	batches;
+		unsigned long	batch_frames;
+		unsigned int	batch_max;
+		unsigned long	retried;	/* frames with ack failures */
+		unsigned long	failed;		/* never acked */
+		/* mem: acxmem_alloc_tx reservation failures */
+		unsigned long	txdesc_short;	/* no free txdesc */
+		unsigned long	txbuf_short;	/* not enough txbuf blocks */
+	} tx_stats;
+	/* Byte/airtime limit on the frames queued between acx_op_tx and
+	 * their tx status, see acx_tx_backlog_add */
+	struct {
+		spinlock_t	lock;
+		unsigned int	bytes;		/* accepted, not completed */
+		unsigned int	limit;		/* bytes */
+		unsigned int	limit_us;	/* airtime budget */
+		unsigned int	rate;		/* effective, 100kbps units */
+		unsigned int	min_slack;	/* bytes, in this period */
+		unsigned long	slack_start;	/* jiffies */
+		int		stopped;	/* in this period */
+		int		held;		/* queues stopped by the limit */
+		unsigned long	stop_count;
+		unsigned long	starve_count;
+	} tx_backlog;
+	/* Rate lookups for the tx and rx paths, built from the band's
+	 * bitrates by acx_init_ieee80211 */
+	struct {
+		u16	hw_value[ACX_MAX_RATES];	/* by mac80211 rate idx */
+		u16	bitrate[ACX_MAX_RATES];
+		u16	rate111[ACX_MAX_RATES];	/* RATE111_x, acx100 too */
+		s8	index[16];	/* by highest_bit(acx111 hw_value) */
+		u8	rx_index[256];	/* by RXBUF_RATE_KEY */
+		u8	count;
+	} rates;
+	/* Rate statistics from the tx status, and the driver rate
+	 * control using them (acx111 only) */
+	struct {
+		int		driver;		/* driver rate control on */
+		int		fixed;		/* rate idx, or -1 */
+		u8		max_tp, max_tp2, max_prob;
+		u8		sample_idx;
+		unsigned int	sample_cnt;
+		unsigned long	next_update;	/* jiffies */
+		unsigned long	bytes;		/* acked, since start */
+		unsigned long	start;		/* jiffies */
+		u32		supp;		/* rate idx the AP supports */
+		struct acx_rc_rate rate[ACX_MAX_RATES];
+	} rc;
 
 #ifdef UNUSED
 	int		dup_count;
@@ -419,6 +555,7 @@ struct acx_device {
 
 	/*** PHY settings ***/
 	u8		fallback_threshold;
+	u8		rate_fallback_retries;	/* ACX1xx_IE_RATE_FALLBACK */
 	u8		stepup_threshold;
 	u16		rate_basic;
 	u16		rate_oper;
@@ -426,7 +563,10 @@ struct acx_device {
 	u16		rate_bcast100;
 	u8		rate_auto;		/* false if "iwconfig rate N" (WITHOUT 'auto'!) */
 	u8		preamble_mode;		/* 0 == Long Preamble, 1 == Short, 2 == Auto */
-	u8		preamble_cur;
+	u8		preamble_cur;		/* short preamble in use, see acx_op_bss_info_changed */
+	u8		pbcc_cur;		/* PBCC at 5.5/11Mbps: we and the BSS support it */
+	u8		short_slot;		/* ERP parameters of the BSS, see */
+	u8		cts_prot;		/* acx_op_bss_info_changed */
 
 	u8		tx_enabled;
 	u8		rx_enabled;
@@ -450,7 +590,7 @@ struct acx_device {
 	u8		ed_threshold;		/* energy detect threshold */
 	u8		cca;			/* clear channel assessment */
 
-	u16		rts_threshold;
+	u16		rts_threshold;	/* see acx_op_set_rts_threshold */
 	u16		frag_threshold;
 	u32		short_retry;
 	u32		long_retry;
@@ -480,6 +620,20 @@ struct acx_device {
 	u16		rx_config_2;
 	u16		memblocksize;
 	u16		phy_header_len;
+	/* On-chip memory pools. The settings are applied by the next
+	 * acx_init_mac (see debugfs mem_pools), the traffic seen since
+	 * the last one feeds the auto mode */
+	struct {
+		unsigned int	block_size;	/* 0: bus default */
+		unsigned int	tx_percent;
+		unsigned int	frag_percent;	/* acx111 */
+		int		auto_mode;
+		unsigned int	cur_tx_percent;	/* in use */
+		unsigned int	cur_frag_percent;
+		unsigned long	tx_bytes;	/* stats at last init */
+		unsigned long	rx_bytes;
+		unsigned int	hist[ACX_POOL_HIST_BINS];
+	} mem_pool;
 
 	/* debugfs */
 	struct dentry	*debugfs_dir;
@@ -496,14 +650,25 @@ struct acx_device {
 	int acx_txbuf_numblocks;
 	u32 acx_txbuf_free;		/* addr of head of free list */
 	int acx_txbuf_blocks_free;	/* how many are still open */
+	u16 *acx_txbuf_next;		/* host copy of the block links */
 	queueindicator_t *acx_queue_indicator;
 #endif
 
 	struct hw_rx_queue hw_rx_queue;
 	int num_hw_tx_queues;
+	/* Descriptors per ring, and the sizes to apply on the next
+	 * acx_op_start (see debugfs ring_sizes) */
+	unsigned int tx_cnt;
+	unsigned int rx_cnt;
+	unsigned int tx_cnt_next;
+	unsigned int rx_cnt_next;
 	/* pointers to tx buffers, tx host descriptors (in host
 	 * memory) and tx descs in device memory, same for rx */
 	struct hw_tx_queue hw_tx_queue[ACX111_MAX_NUM_HW_TX_QUEUES];
+	/* Tx-queues per access category (acx111 pci), see acx_tx_queue_id */
+	int tx_ac_queues;
+	/* Queues that carried hw-encrypted frames since last reset */
+	unsigned long tx_queue_crypt_used;
 
 
 
@@ -547,6 +712,14 @@ struct acx_device {
 
 	usb_tx_t	*usb_tx;
 	usb_rx_t	*usb_rx;
+	/* The bulk-in urbs kept in flight, processed and resubmitted
+	 * in submission order, see acxusb_complete_rx */
+	unsigned int	usb_rx_cnt;
+	unsigned int	usb_rx_head;
+	unsigned int	usb_rx_started;	/* slots submitted by op_start */
+	spinlock_t	usb_rx_lock;	/* slot states, head, started */
+	struct usb_anchor usb_rx_anchor;
+	unsigned long	usb_rx_starved;	/* none left queued */
 
 	int		bulkinep;	/* bulk-in endpoint */
 	int		bulkoutep;	/* bulk-out endpoint */
@@ -121,6 +121,10 @@ typedef struct txhostdesc txhostdesc_t;
 /* We foresee queue_id 0 for unencrypted frames, e.g. mgmt-frames */
 #define NOENC_QUEUE_ID	0
 
+/* The traffic queues 1..4 are used for the access categories VO, VI,
+ * BE and BK, in decreasing priority */
+#define ACX111_AC_QUEUE_ID(ac)	(1 + (ac))
+
 /***********************************************************************
 ** BOM rxbuffer_t
 **
@@ -150,6 +154,16 @@ typedef struct phy_hdr {
 		((le16_to_cpu((rxbuf)->mac_cnt_rcvd) & 0xfff) + RXBUF_HDRSIZE)
 /* USBism */
 #define RXBUF_IS_TXSTAT(rxbuf) (le16_to_cpu((rxbuf)->mac_cnt_rcvd) & 0x8000)
+/* phy_stat_baseband bits, see below */
+#define RXBUF_BB_LONG_PREAMBLE	0x80
+#define RXBUF_BB_PBCC		0x08
+#define RXBUF_BB_OFDM		0x04
+/* Key of adev->rates.rx_index: the plcp signal for CCK/PBCC (the rate
+ * in 100kbps), the OFDM rate code in the otherwise unused 0xf0 row */
+#define RXBUF_RATE_KEY(rxbuf) \
+		(((rxbuf)->phy_stat_baseband & RXBUF_BB_OFDM) ? \
+		 0xf0 | ((rxbuf)->phy_plcp_signal & 0x0f) : \
+		 (rxbuf)->phy_plcp_signal)
 /*
 mac_cnt_rcvd:
     12 bits: length of frame from control field to first byte of FCS
@@ -643,6 +657,14 @@ struct txhostdesc {
 	/* From here on you can use this area as you want (variable length, too!) */
 	u8	*data;
 	struct sk_buff *skb;
+	/* pci: streaming dma mapping of skb->data, see acx_tx_map_skb */
+	dma_addr_t skb_phy;
+	/* pci: non-final fragment of a train, no tx status, see
+	 * acx_tx_data_train */
+	u8	train;
+	/* mem: txbuf blocks reserved along with the txdesc, see
+	 * acxmem_alloc_tx */
+	u32	acx_txbuf;
 } ACX_PACKED;
 
 struct rxhostdesc {
@@ -657,6 +679,11 @@ struct rxhostdesc {
 /***********************************************************************
  * BOM USB structures and constants
  */
+
+/* One bulk-in transfer, in one page. Also the truesize charged for the
+ * page fragments of the frames in it, see acx_rx */
+#define USB_RXBUF_SIZE		4096
+
 #ifdef CONFIG_ACX_MAC80211_USB
 
 /* Used for usb_txbuffer.desc field */
@@ -699,20 +726,16 @@ typedef struct usb_tx {
 	usb_txbuffer_t	bulkout;
 } usb_tx_t;
 
-struct usb_rx_plain {
-	unsigned	busy:1;
-	struct urb	*urb;
-	acx_device_t	*adev;
-	rxbuffer_t	bulkin;
-};
-
 typedef struct usb_rx {
-	unsigned	busy:1;
+	/* Bytes, not bitfields: under usb_rx_lock, see
+	 * acxusb_complete_rx */
+	u8		busy;		/* submitted */
+	u8		done;		/* completed, not yet processed */
 	struct urb	*urb;
 	acx_device_t	*adev;
-	rxbuffer_t	bulkin;
-	/* Make entire structure 4k */
-	u8 padding[4*1024 - sizeof(struct usb_rx_plain)];
+	/* actual USB bulk input data block, see acxusb_poll_rx: the
+	 * frames in it are handed on as page fragments */
+	struct page	*page;
 } usb_rx_t;
 #endif /* ACX_USB */
 
@@ -1084,6 +1107,18 @@ typedef struct acx111_ie_powersave {
 	u32	enhanced_ps_transition_time; /* rem. wake time for Enh. PS */
 } ACX_PACKED acx111_ie_powersave_t;
 
+/* ACX1FF_IE_SLOT_TIME: acx111 only, acx100 has its block size there */
+#define SLOT_TIME_LONG		0	/* 20us */
+#define SLOT_TIME_SHORT		1	/* 9us, ERP */
+
+typedef struct acx111_ie_slot_time {
+	u16	type;
+	u16	len;
+	u8	wone_index;	/* reserved */
+	u8	slot_time;
+	u8	reserved[6];
+} ACX_PACKED acx111_ie_slot_time_t;
+
 
 /***********************************************************************
 ** BOM Commands and template structures
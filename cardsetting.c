@@ -954,8 +954,7 @@ int acx1xx_update_rate_fallback(acx_device_t *adev)
 	u8 *rate = adev->ie_cmd_buf;
 
 	/* configure to not do fallbacks when not in auto rate mode */
-	rate[4] = (adev->rate_auto) /* adev->txrate_fallback_retries */
-		? 1 : 0;
+	rate[4] = (adev->rate_auto) ? adev->rate_fallback_retries : 0;
 	log(L_INIT, "Updating Tx fallback to %u retries\n", rate[4]);
 
 	res = acx_configure(adev, rate, ACX1xx_IE_RATE_FALLBACK);
@@ -963,6 +962,32 @@ int acx1xx_update_rate_fallback(acx_device_t *adev)
 	return res;
 }
 
+int acx111_set_slot_time(acx_device_t *adev, u8 short_slot)
+{
+	int res;
+
+	adev->short_slot = short_slot;
+	res = acx111_update_slot_time(adev);
+
+	return res;
+}
+
+int acx111_update_slot_time(acx_device_t *adev)
+{
+	acx111_ie_slot_time_t slot;
+
+	if (!IS_ACX111(adev))
+		return NOT_OK;
+
+	log(L_INIT, "Updating slot time: %s\n",
+		adev->short_slot ? "short" : "long");
+
+	memset(&slot, 0, sizeof(slot));
+	slot.slot_time = adev->short_slot ? SLOT_TIME_SHORT : SLOT_TIME_LONG;
+
+	return acx_configure(adev, &slot, ACX1FF_IE_SLOT_TIME);
+}
+
 #ifdef UNUSED
 static int acx1xx_set_channel(acx_device_t *adev, u8 channel)
 {
@@ -1598,6 +1623,22 @@ static void acx_update_ratevector(acx_device_t *adev)
 }
 
 
+/*
+ * acx_set_rate_basic
+ *
+ * The firmware takes the basic rates with the join command only, see
+ * acx_cmd_join_bssid. This updates the driver side: the supported
+ * rates element and the lowest basic rate used on tx.
+ */
+void acx_set_rate_basic(acx_device_t *adev, u16 rate_basic)
+{
+	log(L_ASSOC, "rate_basic: %04X -> %04X\n",
+		adev->rate_basic, rate_basic);
+
+	adev->rate_basic = rate_basic;
+	acx_update_ratevector(adev);
+}
+
 static int acx_update_rx_config(acx_device_t *adev)
 {
 	int res;
@@ -1848,6 +1889,7 @@ void acx_set_defaults(acx_device_t *adev)
 
 	adev->preamble_mode = 2;	/* auto */
 	adev->fallback_threshold = 3;
+	adev->rate_fallback_retries = ACX_RATE_FALLBACK_RETRIES;
 	adev->stepup_threshold = 10;
 	adev->rate_bcast = RATE111_1;
 	adev->rate_bcast100 = RATE100_1;
@@ -33,6 +33,9 @@ int acx1xx_update_station_id(acx_device_t *adev);
 int acx1xx_update_ed_threshold(acx_device_t *adev);
 int acx1xx_update_cca(acx_device_t *adev);
 int acx1xx_update_rate_fallback(acx_device_t *adev);
+int acx111_set_slot_time(acx_device_t *adev, u8 short_slot);
+int acx111_update_slot_time(acx_device_t *adev);
+void acx_set_rate_basic(acx_device_t *adev, u16 rate_basic);
 int acx1xx_update_tx(acx_device_t *adev);
 int acx1xx_set_rx_enable(acx_device_t *adev, u8 rx_enabled);
 int acx1xx_update_rx(acx_device_t *adev);
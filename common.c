@@ -151,6 +151,34 @@ unsigned int acx_watchdog_enable = 0;
 module_param_named(watchdog, acx_watchdog_enable, uint, 0644);
 MODULE_PARM_DESC(debug, "Enable watchdog");
 
+unsigned int acx_tx_ring_size = TX_CNT;
+module_param_named(tx_ring_size, acx_tx_ring_size, uint, 0444);
+MODULE_PARM_DESC(tx_ring_size, "Descriptors per tx ring");
+
+unsigned int acx_rx_ring_size = RX_CNT;
+module_param_named(rx_ring_size, acx_rx_ring_size, uint, 0444);
+MODULE_PARM_DESC(rx_ring_size, "Descriptors in the rx ring");
+
+unsigned int acx_mem_block_size = 0;
+module_param_named(mem_block_size, acx_mem_block_size, uint, 0444);
+MODULE_PARM_DESC(mem_block_size, "On-chip memory block size: 128, 256 or 512 (0 bus default)");
+
+unsigned int acx_mem_tx_percent = 50;
+module_param_named(mem_tx_percent, acx_mem_tx_percent, uint, 0444);
+MODULE_PARM_DESC(mem_tx_percent, "Share of the on-chip memory blocks for tx, in %");
+
+unsigned int acx_mem_frag_percent = 75;
+module_param_named(mem_frag_percent, acx_mem_frag_percent, uint, 0444);
+MODULE_PARM_DESC(mem_frag_percent, "Share of the on-chip memory for frame transfers, in % (acx111)");
+
+unsigned int acx_mem_pool_auto = 0;
+module_param_named(mem_pool_auto, acx_mem_pool_auto, uint, 0444);
+MODULE_PARM_DESC(mem_pool_auto, "Pick the memory split and block size from the traffic on each reset");
+
+unsigned int acx_rate_control = 0;
+module_param_named(rate_control, acx_rate_control, uint, 0444);
+MODULE_PARM_DESC(rate_control, "Tx rate control: 0 mac80211, 1 driver (acx111, pci/mem)");
+
 #if ACX_DEBUG
 
 /* will add __read_mostly later */
@@ -36,11 +36,14 @@
 #include "cardsetting.h"
 #include "main.h"
 #include "boot.h"
+#include "tx.h"
+#include "init.h"
 #include "debug.h"
 
 enum file_index {
 	INFO, DIAG, EEPROM, PHY, DEBUG,
 	SENSITIVITY, TX_LEVEL, ANTENNA, REG_DOMAIN,
+	TX_STATS, RING_SIZES, RATE_STATS, MEM_POOLS,
 };
 static const char *const dbgfs_files[] = {
 	[INFO]		= "info",
@@ -52,9 +55,13 @@ static const char *const dbgfs_files[] = {
 	[TX_LEVEL]	= "tx_level",
 	[ANTENNA]	= "antenna",
 	[REG_DOMAIN]	= "reg_domain",
+	[TX_STATS]	= "tx_stats",
+	[RING_SIZES]	= "ring_sizes",
+	[RATE_STATS]	= "rate_stats",
+	[MEM_POOLS]	= "mem_pools",
 };
-BUILD_BUG_DECL(dbgfs_files__VS__enum_REG_DOMAIN,
-	ARRAY_SIZE(dbgfs_files) != REG_DOMAIN + 1);
+BUILD_BUG_DECL(dbgfs_files__VS__enum_MEM_POOLS,
+	ARRAY_SIZE(dbgfs_files) != MEM_POOLS + 1);
 
 static struct dentry *acx_dbgfs_dir;
 
@@ -111,6 +118,9 @@ static int acx_dbgfs_show_diag(struct seq_file *file, void *v)
 
 	seq_printf(file, "tx_queue len: %d\n", skb_queue_len(&adev->tx_queue));
 
+	seq_printf(file, "tx_ac_queues: %d, tx_queue_crypt_used: 0x%02lx\n",
+		adev->tx_ac_queues, adev->tx_queue_crypt_used);
+
 	seq_printf(file, "\n" "** PHY status **\n"
 		"tx_enabled %d, tx_level_dbm %d, tx_level_val %d,\n "
 		/* "tx_level_auto %d\n" */
@@ -798,6 +808,265 @@ out:
 	return ret;
 }
 
+static int acx_dbgfs_show_tx_stats(struct seq_file *file, void *v)
+{
+	acx_device_t *adev = (acx_device_t *) file->private;
+	unsigned long batches = adev->tx_stats.batches;
+	unsigned long frames = adev->tx_stats.batch_frames;
+	struct hw_tx_queue *txq;
+	int i;
+
+	/* Plain counters, no sem locking required */
+	seq_printf(file,
+		"doorbells: %lu\n"
+		"batches: %lu, batch_frames: %lu, batch_max: %u, "
+		"batch_avg: %lu\n",
+		adev->tx_stats.doorbells,
+		batches, frames, adev->tx_stats.batch_max,
+		batches ? frames / batches : 0);
+
+	seq_printf(file,
+		"backlog: %u bytes, limit %u bytes, %u us, rate %u.%u Mbps\n"
+		"backlog stops: %lu, starvations: %lu\n",
+		adev->tx_backlog.bytes, adev->tx_backlog.limit,
+		adev->tx_backlog.limit_us, adev->tx_backlog.rate / 10,
+		adev->tx_backlog.rate % 10, adev->tx_backlog.stop_count,
+		adev->tx_backlog.starve_count);
+
+	seq_printf(file,
+		"retried: %lu, failed: %lu, ack failures: %u\n"
+		"rts ok: %u, rts failures: %u, rts_threshold: %u\n",
+		adev->tx_stats.retried, adev->tx_stats.failed,
+		adev->ieee_stats.dot11ACKFailureCount,
+		adev->ieee_stats.dot11RTSSuccessCount,
+		adev->ieee_stats.dot11RTSFailureCount, adev->rts_threshold);
+
+	if (IS_MEM(adev))
+		seq_printf(file,
+			"txbuf: %d of %d blocks free, "
+			"txdesc short: %lu, txbuf short: %lu\n",
+			adev->acx_txbuf_blocks_free, adev->acx_txbuf_numblocks,
+			adev->tx_stats.txdesc_short,
+			adev->tx_stats.txbuf_short);
+
+	for (i = 0; i < adev->num_hw_tx_queues; i++) {
+		txq = &adev->hw_tx_queue[i];
+		seq_printf(file, "queue %d: free %u, stopped %d, "
+			"stops %lu, wakes %lu\n", i, txq->free,
+			txq->stopped, txq->stop_count, txq->wake_count);
+	}
+
+	return 0;
+}
+
+static int acx_dbgfs_show_ring_sizes(struct seq_file *file, void *v)
+{
+	acx_device_t *adev = (acx_device_t *) file->private;
+
+	acx_sem_lock(adev);
+
+	seq_printf(file, "tx_cnt: %u, rx_cnt: %u\n"
+		"next tx_cnt: %u, rx_cnt: %u\n",
+		adev->tx_cnt, adev->rx_cnt,
+		adev->tx_cnt_next, adev->rx_cnt_next);
+
+#ifdef CONFIG_ACX_MAC80211_USB
+	if (IS_USB(adev))
+		seq_printf(file, "usb rx urbs: %u, starved: %lu\n",
+			adev->usb_rx_cnt, adev->usb_rx_starved);
+#endif
+
+	acx_sem_unlock(adev);
+
+	return 0;
+}
+
+/* Writing 0xRRTT sets the rx (RR) and tx (TT) ring sizes, applied on
+ * the next start of the interface */
+static ssize_t acx_dbgfs_write_ring_sizes(acx_device_t *adev, struct file *file,
+                                         const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	ssize_t ret = -EINVAL;
+	char *after, buf[32];
+	unsigned long val;
+	unsigned int tx, rx;
+	size_t size, len;
+
+
+	len = min(count, sizeof(buf) - 1);
+	if (unlikely(copy_from_user(buf, ubuf, len)))
+		return -EFAULT;
+	buf[len] = '\0';
+
+	acx_sem_lock(adev);
+
+	val = simple_strtoul(buf, &after, 0);
+	size = after - buf + 1;
+
+	if (count != size)
+		goto out;
+
+	tx = val & 0xFF;
+	rx = (val >> 8) & 0xFF;
+	if (tx < ACX_MIN_RING_CNT || rx < ACX_MIN_RING_CNT)
+		goto out;
+
+	ret = count;
+
+	adev->tx_cnt_next = tx;
+	adev->rx_cnt_next = rx;
+	logf1(L_ANY, "next tx_cnt=%u, rx_cnt=%u\n", tx, rx);
+
+out:
+	acx_sem_unlock(adev);
+
+	return ret;
+}
+
+static int acx_dbgfs_show_rate_stats(struct seq_file *file, void *v)
+{
+	acx_device_t *adev = (acx_device_t *) file->private;
+	struct acx_rc_rate *r;
+	unsigned long msecs;
+	int i;
+
+	/* Plain counters, no sem locking required */
+	msecs = jiffies_to_msecs(jiffies - adev->rc.start);
+	seq_printf(file, "rate control: %s, fixed rate idx: %d, "
+		"fallback retries: %u\n"
+		"goodput: %lu kbit/s (%lu bytes acked in %lu ms)\n",
+		adev->rc.driver ? "driver" : "mac80211", adev->rc.fixed,
+		adev->rate_fallback_retries,
+		msecs ? adev->rc.bytes * 8 / msecs : 0,
+		adev->rc.bytes, msecs);
+
+	seq_printf(file, "idx rate  attempts   success  prob  tp\n");
+	for (i = 0; i < adev->rates.count; i++) {
+		r = &adev->rc.rate[i];
+		seq_printf(file, "%2d %3u.%u %9lu %9lu %3u.%u %3u.%u %s%s%s\n",
+			i, adev->rates.bitrate[i] / 10,
+			adev->rates.bitrate[i] % 10,
+			r->attempts_total, r->success_total,
+			r->prob / 10, r->prob % 10, r->tp / 10, r->tp % 10,
+			(i == adev->rc.max_tp) ? "T" : "",
+			(i == adev->rc.max_tp2) ? "t" : "",
+			(i == adev->rc.max_prob) ? "P" : "");
+	}
+
+	return 0;
+}
+
+/* Writing a rate idx fixes the rate of unicast data frames, e.g. as
+ * throughput baseline, -1 goes back to rate control. Resets the
+ * statistics. */
+static ssize_t acx_dbgfs_write_rate_stats(acx_device_t *adev, struct file *file,
+                                         const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	ssize_t ret = -EINVAL;
+	char *after, buf[32];
+	long val;
+	size_t size, len;
+
+	len = min(count, sizeof(buf) - 1);
+	if (unlikely(copy_from_user(buf, ubuf, len)))
+		return -EFAULT;
+	buf[len] = '\0';
+
+	acx_sem_lock(adev);
+
+	val = simple_strtol(buf, &after, 0);
+	size = after - buf + 1;
+
+	if (count != size)
+		goto out;
+
+	if (!IS_ACX111(adev) || val < -1 || val >= adev->rates.count)
+		goto out;
+
+	ret = count;
+
+	acx_tx_lock(adev);
+	adev->rc.fixed = val;
+	acx_rc_reset(adev);
+	acx_tx_unlock(adev);
+	logf1(L_ANY, "fixed rate idx=%ld\n", val);
+
+out:
+	acx_sem_unlock(adev);
+
+	return ret;
+}
+
+static int acx_dbgfs_show_mem_pools(struct seq_file *file, void *v)
+{
+	acx_device_t *adev = (acx_device_t *) file->private;
+	int i;
+
+	acx_sem_lock(adev);
+
+	seq_printf(file, "block size: %u, tx: %u%%, frag: %u%%\n"
+		"next block size: %u, tx: %u%%, frag: %u%%, auto: %d\n"
+		"since: tx %lu bytes, rx %lu bytes\n",
+		adev->memblocksize, adev->mem_pool.cur_tx_percent,
+		adev->mem_pool.cur_frag_percent,
+		adev->mem_pool.block_size, adev->mem_pool.tx_percent,
+		adev->mem_pool.frag_percent, adev->mem_pool.auto_mode,
+		adev->stats.tx_bytes - adev->mem_pool.tx_bytes,
+		adev->stats.rx_bytes - adev->mem_pool.rx_bytes);
+
+	seq_printf(file, "frame lengths:\n");
+	for (i = 0; i < ACX_POOL_HIST_BINS; i++)
+		if (adev->mem_pool.hist[i])
+			seq_printf(file, "%5u%s %u\n", i * 64,
+				(i == ACX_POOL_HIST_BINS - 1) ? "+" : " ",
+				adev->mem_pool.hist[i]);
+
+	acx_sem_unlock(adev);
+
+	return 0;
+}
+
+/* Writing "<block size> <tx %> <frag %> <auto>" sets the memory
+ * pools for the next start of the interface, block size 0 is the bus
+ * default */
+static ssize_t acx_dbgfs_write_mem_pools(acx_device_t *adev, struct file *file,
+                                         const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	ssize_t ret = -EINVAL;
+	char buf[32];
+	unsigned int block_size, tx, frag;
+	int auto_mode;
+	size_t len;
+
+	len = min(count, sizeof(buf) - 1);
+	if (unlikely(copy_from_user(buf, ubuf, len)))
+		return -EFAULT;
+	buf[len] = '\0';
+
+	acx_sem_lock(adev);
+
+	if (sscanf(buf, "%u %u %u %d", &block_size, &tx, &frag,
+			&auto_mode) != 4)
+		goto out;
+
+	if (!acx_mem_pool_valid(block_size, tx, frag))
+		goto out;
+
+	ret = count;
+
+	adev->mem_pool.block_size = block_size;
+	adev->mem_pool.tx_percent = tx;
+	adev->mem_pool.frag_percent = frag;
+	adev->mem_pool.auto_mode = !!auto_mode;
+	logf1(L_ANY, "next block size=%u, tx=%u%%, frag=%u%%, auto=%d\n",
+		block_size, tx, frag, adev->mem_pool.auto_mode);
+
+out:
+	acx_sem_unlock(adev);
+
+	return ret;
+}
+
 static acx_dbgfs_show_t *const acx_dbgfs_show_funcs[] = {
 	acx_dbgfs_show_acx,
 	acx_dbgfs_show_diag,
@@ -808,6 +1077,10 @@ static acx_dbgfs_show_t *const acx_dbgfs_show_funcs[] = {
 	acx_dbgfs_show_tx_level,
 	acx_dbgfs_show_antenna,
 	acx_dbgfs_show_reg_domain,
+	acx_dbgfs_show_tx_stats,
+	acx_dbgfs_show_ring_sizes,
+	acx_dbgfs_show_rate_stats,
+	acx_dbgfs_show_mem_pools,
 };
 
 static acx_dbgfs_write_t *const acx_dbgfs_write_funcs[] = {
@@ -820,6 +1093,10 @@ static acx_dbgfs_write_t *const acx_dbgfs_write_funcs[] = {
 	acx_dbgfs_write_tx_level,
 	acx_dbgfs_write_antenna,
 	acx_dbgfs_write_reg_domain,
+	NULL,
+	acx_dbgfs_write_ring_sizes,
+	acx_dbgfs_write_rate_stats,
+	acx_dbgfs_write_mem_pools,
 };
 BUILD_BUG_DECL(acx_proc_show_funcs__VS__acx_proc_write_funcs,
 	ARRAY_SIZE(acx_dbgfs_show_funcs) != ARRAY_SIZE(acx_dbgfs_write_funcs));
@@ -840,6 +1117,10 @@ static int acx_dbgfs_open(struct inode *inode, struct file *file)
 	case TX_LEVEL:
 	case ANTENNA:
 	case REG_DOMAIN:
+	case TX_STATS:
+	case RING_SIZES:
+	case RATE_STATS:
+	case MEM_POOLS:
 		pr_devel("opening filename=%s fmode=%o fidx=%d adev=%p\n",
 			dbgfs_files[fidx], file->f_mode, (int)fidx, adev);
 		break;
@@ -869,6 +1150,10 @@ static ssize_t acx_dbgfs_write(struct file *file, const char __user *buf,
 	case TX_LEVEL:
 	case ANTENNA:
 	case REG_DOMAIN:
+	case TX_STATS:
+	case RING_SIZES:
+	case RATE_STATS:
+	case MEM_POOLS:
 		pr_devel("opening filename=%s fmode=%o fidx=%d adev=%p\n",
 			dbgfs_files[fidx], file->f_mode, (int)fidx, adev);
 		break;
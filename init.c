@@ -182,6 +182,113 @@ success:
 	return result;
 }
 
+/*
+ * BOM Memory pools
+ * ==================================================
+ */
+
+/* Auto mode: traffic needed before the split or the block size are
+ * changed, and what a link to a further block costs, in bytes of
+ * block memory */
+#define ACX_POOL_AUTO_MIN_BYTES	(1024 * 1024)
+#define ACX_POOL_AUTO_MIN_FRAMES	256
+#define ACX_POOL_CHAIN_COST	32
+
+static const u16 acx_pool_block_sizes[] = { 128, 256, 512 };
+
+int acx_mem_pool_valid(unsigned int block_size, unsigned int tx_percent,
+		unsigned int frag_percent)
+{
+	int i;
+
+	/* The acx111 takes percentages in units of 5% */
+	if (tx_percent < 10 || tx_percent > 90 || tx_percent % 5)
+		return 0;
+	if (frag_percent < 5 || frag_percent > 100 || frag_percent % 5)
+		return 0;
+	if (!block_size)
+		return 1;
+
+	for (i = 0; i < ARRAY_SIZE(acx_pool_block_sizes); i++)
+		if (block_size == acx_pool_block_sizes[i])
+			return 1;
+	return 0;
+}
+
+/*
+ * acx_mem_pool_pick_auto
+ *
+ * The tx share follows the tx/rx byte ratio since the last
+ * acx_init_mac, kept within 20-80% so neither side starves. The block
+ * size is the one the frame length histogram fits best: the block
+ * memory taken plus ACX_POOL_CHAIN_COST per chained block. The bus
+ * default is kept on usb.
+ */
+static void acx_mem_pool_pick_auto(acx_device_t *adev)
+{
+	u64 tx, rx, cost, best_cost = 0;
+	unsigned int frames = 0, len, blocks, size;
+	int i, j;
+
+	tx = adev->stats.tx_bytes - adev->mem_pool.tx_bytes;
+	rx = adev->stats.rx_bytes - adev->mem_pool.rx_bytes;
+	if (tx + rx >= ACX_POOL_AUTO_MIN_BYTES)
+		adev->mem_pool.cur_tx_percent = clamp_t(unsigned int,
+			div64_u64(tx * 20 + (tx + rx) / 2, tx + rx) * 5,
+			20, 80);
+
+	for (i = 0; i < ACX_POOL_HIST_BINS; i++)
+		frames += adev->mem_pool.hist[i];
+	if (IS_USB(adev) || frames < ACX_POOL_AUTO_MIN_FRAMES)
+		return;
+
+	for (j = 0; j < ARRAY_SIZE(acx_pool_block_sizes); j++) {
+		size = acx_pool_block_sizes[j];
+		cost = 0;
+		for (i = 0; i < ACX_POOL_HIST_BINS; i++) {
+			/* middle of the bin, the first word of a block
+			 * is the link */
+			len = i * 64 + 32;
+			blocks = DIV_ROUND_UP(len, size - 4);
+			cost += (u64) adev->mem_pool.hist[i] * (blocks * size
+				+ (blocks - 1) * ACX_POOL_CHAIN_COST);
+		}
+		if (!j || cost < best_cost) {
+			best_cost = cost;
+			adev->memblocksize = size;
+		}
+	}
+}
+
+/*
+ * acx_mem_pool_setup
+ *
+ * Settle the block size and the tx/rx split for this acx_init_mac,
+ * and start over with the traffic statistics
+ */
+static void acx_mem_pool_setup(acx_device_t *adev)
+{
+	if (adev->mem_pool.block_size)
+		adev->memblocksize = adev->mem_pool.block_size;
+	else if (IS_PCI(adev) || IS_MEM(adev))
+		adev->memblocksize = 256;	/* 256 is default */
+	else
+		adev->memblocksize = 128;
+	adev->mem_pool.cur_tx_percent = adev->mem_pool.tx_percent;
+	adev->mem_pool.cur_frag_percent = adev->mem_pool.frag_percent;
+
+	if (adev->mem_pool.auto_mode)
+		acx_mem_pool_pick_auto(adev);
+
+	log(L_INIT, "memory pools: block size %u, tx %u%%, frag %u%%\n",
+		adev->memblocksize, adev->mem_pool.cur_tx_percent,
+		adev->mem_pool.cur_frag_percent);
+
+	adev->mem_pool.tx_bytes = adev->stats.tx_bytes;
+	adev->mem_pool.rx_bytes = adev->stats.rx_bytes;
+	memset(adev->mem_pool.hist, 0, sizeof(adev->mem_pool.hist));
+}
+
 /*
  * acx111_s_create_dma_regions
  *
@@ -199,6 +306,7 @@ static int acx111_create_dma_regions(acx_device_t *adev)
 
 	adev->num_hw_tx_queues = ACX111_NUM_HW_TX_QUEUES;
 
+again:
 	/* Calculate memory positions and queue sizes */
 
 	/* Set up our host descriptor pool + data pool */
@@ -214,8 +322,9 @@ static int acx111_create_dma_regions(acx_device_t *adev)
 
 	/* specify the memory block size. Default is 256 */
 	memconf.memory_block_size = cpu_to_le16(adev->memblocksize);
-	/* let's use 50%/50% for tx/rx (specify percentage, units of 5%) */
-	memconf.tx_rx_memory_block_allocation = ACX111_PERCENT(50);
+	/* tx share, 50% by default (specify percentage, units of 5%) */
+	memconf.tx_rx_memory_block_allocation =
+		ACX111_PERCENT(adev->mem_pool.cur_tx_percent);
 	/* set the count of our queues
 	 ** NB: struct acx111_ie_memoryconfig shall be modified
 	 ** if we ever will switch to more than one rx and/or tx queue */
@@ -225,11 +334,12 @@ static int acx111_create_dma_regions(acx_device_t *adev)
 	 * we want (using linked host descs with their allocated mem).
 	 * 2 == Generic Bus Slave */
 	/* done by memset: memconf.options = 0; */
-	/* let's use 25% for fragmentations and 75% for frame transfers
-	 * (specified in units of 5%) */
-	memconf.fragmentation = ACX111_PERCENT(75);
+	/* by default 25% for fragmentations and 75% for frame
+	 * transfers (specified in units of 5%) */
+	memconf.fragmentation =
+		ACX111_PERCENT(adev->mem_pool.cur_frag_percent);
 	/* Rx descriptor queue config */
-	memconf.rx_queue1_count_descs = RX_CNT;
+	memconf.rx_queue1_count_descs = adev->rx_cnt;
 	memconf.rx_queue1_type = 7;	/* must be set to 7 */
 
 	/* done by memset: memconf.rx_queue1_prio = 0; low prio */
@@ -246,18 +356,36 @@ static int acx111_create_dma_regions(acx_device_t *adev)
 		#endif
 	}
 
-	/* Tx descriptor queue config */
+	/* Tx descriptor queue config. Queue 0 (NOENC_QUEUE_ID) gets
+	 * the highest attribute, followed by the access category queues
+	 * VO, VI, BE, BK (see ACX111_AC_QUEUE_ID) */
 	for (i = 0; i < ACX111_NUM_HW_TX_QUEUES; i++) {
-		memconf.tx_queue[i].count_descs = TX_CNT;
+		memconf.tx_queue[i].count_descs = adev->tx_cnt;
 
 		// TODO check if prio if up- or downwards
 		/* done by memset: memconf.tx_queue1_attributes = 0; lowest priority */
 		memconf.tx_queue[i].attributes = ACX111_NUM_HW_TX_QUEUES - 1 - i;
 	}
 
-
-	if (OK != acx_configure(adev, &memconf, ACX111_IE_MEMORY_CONFIG_OPTIONS))
+	/* Fresh queues, nothing was hw-encrypted on them yet */
+	adev->tx_queue_crypt_used = 0;
+
+
+	if (OK != acx_configure(adev, &memconf, ACX111_IE_MEMORY_CONFIG_OPTIONS)) {
+		/* Firmware didn't take our ring sizes, retry with the
+		 * defaults */
+		if (adev->tx_cnt != TX_CNT || adev->rx_cnt != RX_CNT) {
+			pr_acx("ring sizes tx %u, rx %u rejected, "
+				"using tx %u, rx %u\n", adev->tx_cnt,
+				adev->rx_cnt, TX_CNT, RX_CNT);
+			if (IS_PCI(adev) || IS_MEM(adev))
+				acx_free_desc_queues(adev);
+			adev->tx_cnt = adev->tx_cnt_next = TX_CNT;
+			adev->rx_cnt = adev->rx_cnt_next = RX_CNT;
+			goto again;
+		}
 		goto fail;
+	}
 
 	memset(&queueconf, 0, sizeof(queueconf));
 	acx_interrogate(adev, &queueconf, ACX111_IE_QUEUE_CONFIG);
@@ -454,11 +582,12 @@ static int acx100_init_memory_pools(acx_device_t *adev,
 	else
 		MemoryConfigOption.DMA_config = cpu_to_le32(0x20000);
 
-	/* 50% of the allotment of memory blocks go to tx descriptors */
-	TxBlockNum = TotalMemoryBlocks / 2;
+	/* cur_tx_percent (50% by default) of the allotment of memory
+	 * blocks go to tx descriptors */
+	TxBlockNum = TotalMemoryBlocks * adev->mem_pool.cur_tx_percent / 100;
 	MemoryConfigOption.TxBlockNum = cpu_to_le16(TxBlockNum);
 
-	/* and 50% go to the rx descriptors */
+	/* and the rest go to the rx descriptors */
 	RxBlockNum = TotalMemoryBlocks - TxBlockNum;
 	MemoryConfigOption.RxBlockNum = cpu_to_le16(RxBlockNum);
 
@@ -498,6 +627,16 @@ static int acx100_init_memory_pools(acx_device_t *adev,
 	 */
 	adev->acx_txbuf_start = MemoryConfigOption.tx_mem;
 	adev->acx_txbuf_numblocks = MemoryConfigOption.TxBlockNum;
+
+	/* host copy of the block links, see acxmem_init_acx_txbuf */
+	if (IS_MEM(adev)) {
+		kfree(adev->acx_txbuf_next);
+		adev->acx_txbuf_next = kcalloc(adev->acx_txbuf_numblocks,
+					sizeof(*adev->acx_txbuf_next),
+					GFP_KERNEL);
+		if (!adev->acx_txbuf_next)
+			goto bad;
+	}
 #endif
 
 
@@ -528,7 +667,20 @@ static int acx100_create_dma_regions(acx_device_t * adev)
 		goto fail;
 
 	tx_queue_start = le32_to_cpu(memmap.QueueStart);
-	rx_queue_start = tx_queue_start + TX_CNT * sizeof(txacxdesc_t);
+
+	/* The descriptor rings must leave at least half of the memory
+	 * up to PoolEnd for the tx/rx buffer pools */
+	if (adev->tx_cnt * sizeof(txacxdesc_t)
+		+ adev->rx_cnt * sizeof(rxacxdesc_t)
+		> (le32_to_cpu(memmap.PoolEnd) - tx_queue_start) / 2) {
+		pr_acx("ring sizes tx %u, rx %u exceed the memory map, "
+			"using tx %u, rx %u\n", adev->tx_cnt, adev->rx_cnt,
+			TX_CNT, RX_CNT);
+		adev->tx_cnt = adev->tx_cnt_next = TX_CNT;
+		adev->rx_cnt = adev->rx_cnt_next = RX_CNT;
+	}
+
+	rx_queue_start = tx_queue_start + adev->tx_cnt * sizeof(txacxdesc_t);
 
 	log(L_DEBUG, "Initializing Queue Indicator\n");
 
@@ -541,8 +693,8 @@ static int acx100_create_dma_regions(acx_device_t * adev)
 	}
 
 	/* calculate size of queues */
-	queueconf.AreaSize = cpu_to_le32(TX_CNT * sizeof(txacxdesc_t) +
-					 RX_CNT * sizeof(rxacxdesc_t) + 8);
+	queueconf.AreaSize = cpu_to_le32(adev->tx_cnt * sizeof(txacxdesc_t) +
+					 adev->rx_cnt * sizeof(rxacxdesc_t) + 8);
 	queueconf.NumTxQueues = 1;	/* number of tx queues */
 	/* sets the beginning of the tx descriptor queue */
 	queueconf.TxQueueStart = memmap.QueueStart;
@@ -551,7 +703,7 @@ static int acx100_create_dma_regions(acx_device_t * adev)
 	queueconf.QueueOptions = 1;	/* auto reset descriptor */
 	/* sets the end of the rx descriptor queue */
 	queueconf.QueueEnd =
-	    cpu_to_le32(rx_queue_start + RX_CNT * sizeof(rxacxdesc_t)
+	    cpu_to_le32(rx_queue_start + adev->rx_cnt * sizeof(rxacxdesc_t)
 	    );
 	/* sets the beginning of the next queue */
 	queueconf.HostQueueEnd =
@@ -612,16 +764,14 @@ int acx_init_mac(acx_device_t * adev)
 {
 	int result = NOT_OK;
 
+	acx_mem_pool_setup(adev);
+
 	if (IS_PCI(adev) || IS_MEM(adev) ) {
-		adev->memblocksize = 256;	/* 256 is default */
 		/* try to load radio for both ACX100 and ACX111, since both
 		 * chips have at least some firmware versions making use of an
 		 * external radio module */
 		acx_upload_radio(adev);
 	}
-	else {
-		adev->memblocksize = 128;
-	}
 
 	if (IS_ACX111(adev)) {
 		/* for ACX111, the order is different from ACX100
@@ -4,5 +4,14 @@
 #include "acx.h"
 
 int acx_init_mac(acx_device_t * adev);
+int acx_mem_pool_valid(unsigned int block_size, unsigned int tx_percent,
+		unsigned int frag_percent);
+
+/* Frame length histogram for acx_mem_pool_pick_auto */
+static inline void acx_mem_pool_count(acx_device_t *adev, unsigned int len)
+{
+	adev->mem_pool.hist[min_t(unsigned int, len >> 6,
+				ACX_POOL_HIST_BINS - 1)]++;
+}
 
 #endif
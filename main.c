@@ -28,6 +28,7 @@
 #include "pci.h"
 #include "cmd.h"
 #include "ie.h"
+#include "init.h"
 #include "utils.h"
 #include "cardsetting.h"
 #include "tx.h"
@@ -42,23 +43,31 @@
  * ==================================================
  */
 
-/* We define rates without short-preamble support fo now */
+/* The CCK rates above 1Mbps allow the short preamble. The tx path
+ * uses it when the BSS does, see acx_op_bss_info_changed. */
 
 static struct ieee80211_rate acx100_rates[] = {
 	{ .bitrate = 10, .hw_value = RATE100_1, },
-	{ .bitrate = 20, .hw_value = RATE100_2, },
-	{ .bitrate = 55, .hw_value = RATE100_5, },
-	{ .bitrate = 110, .hw_value = RATE100_11, },
-	{ .bitrate = 220, .hw_value = RATE100_22, },
+	{ .bitrate = 20, .hw_value = RATE100_2,
+	  .flags = IEEE80211_RATE_SHORT_PREAMBLE, },
+	{ .bitrate = 55, .hw_value = RATE100_5,
+	  .flags = IEEE80211_RATE_SHORT_PREAMBLE, },
+	{ .bitrate = 110, .hw_value = RATE100_11,
+	  .flags = IEEE80211_RATE_SHORT_PREAMBLE, },
+	{ .bitrate = 220, .hw_value = RATE100_22,
+	  .flags = IEEE80211_RATE_SHORT_PREAMBLE, },
 };
 
-struct ieee80211_rate acx111_rates[] = {
+static struct ieee80211_rate acx111_rates[] = {
 	{ .bitrate = 10, .hw_value = RATE111_1, },
-	{ .bitrate = 20, .hw_value = RATE111_2, },
-	{ .bitrate = 55, .hw_value = RATE111_5, },
+	{ .bitrate = 20, .hw_value = RATE111_2,
+	  .flags = IEEE80211_RATE_SHORT_PREAMBLE, },
+	{ .bitrate = 55, .hw_value = RATE111_5,
+	  .flags = IEEE80211_RATE_SHORT_PREAMBLE, },
 	{ .bitrate = 60, .hw_value = RATE111_6, },
 	{ .bitrate = 90, .hw_value = RATE111_9, },
-	{ .bitrate = 110, .hw_value = RATE111_11, },
+	{ .bitrate = 110, .hw_value = RATE111_11,
+	  .flags = IEEE80211_RATE_SHORT_PREAMBLE, },
 	{ .bitrate = 120, .hw_value = RATE111_12, },
 	{ .bitrate = 180, .hw_value = RATE111_18, },
 	{ .bitrate = 240, .hw_value = RATE111_24, },
@@ -66,7 +75,6 @@ struct ieee80211_rate acx111_rates[] = {
 	{ .bitrate = 480, .hw_value = RATE111_48, },
 	{ .bitrate = 540, .hw_value = RATE111_54, },
 };
-const int acx111_rates_sizeof=ARRAY_SIZE(acx111_rates);
 
 static struct ieee80211_channel channels[] = {
 	{ .center_freq = 2412, .hw_value = 1, .max_power = TX_CFG_MAX_DBM_POWER },
@@ -299,6 +307,13 @@ void acx_after_interrupt_task(acx_device_t *adev)
 			ACX_AFTER_IRQ_UPDATE_TIM);
 	}
 
+	if (adev->after_interrupt_jobs & ACX_AFTER_IRQ_UPDATE_RATE_FALLBACK) {
+		log(L_IRQ, "ACX_AFTER_IRQ_UPDATE_RATE_FALLBACK\n");
+		acx1xx_update_rate_fallback(adev);
+		CLEAR_BIT(adev->after_interrupt_jobs,
+			ACX_AFTER_IRQ_UPDATE_RATE_FALLBACK);
+	}
+
 	/* others */
 	if(adev->after_interrupt_jobs)
 	{
@@ -460,6 +475,8 @@ static void acx_watchdog_work(struct work_struct *work)
 /* Locking, queueing, etc. mechanics */
 int acx_init_mechanics(acx_device_t *adev)
 {
+	int i;
+
 	/* Locking */
 	spin_lock_init(&adev->spinlock);
 	mutex_init(&adev->mutex);
@@ -473,6 +490,29 @@ int acx_init_mechanics(acx_device_t *adev)
 	/* Skb tx-queue from mac80211 */
 	INIT_WORK(&adev->tx_work, acx_tx_work);
 	skb_queue_head_init(&adev->tx_queue);
+	spin_lock_init(&adev->tx_lock);
+	acx_tx_backlog_init(adev);
+	for (i = 0; i < IEEE80211_NUM_ACS; i++)
+		__skb_queue_head_init(&adev->tx_frags[i]);
+
+	adev->tx_cnt = clamp_t(unsigned int, acx_tx_ring_size,
+			ACX_MIN_RING_CNT, ACX_MAX_RING_CNT);
+	adev->rx_cnt = clamp_t(unsigned int, acx_rx_ring_size,
+			ACX_MIN_RING_CNT, ACX_MAX_RING_CNT);
+	adev->tx_cnt_next = adev->tx_cnt;
+	adev->rx_cnt_next = adev->rx_cnt;
+
+	if (acx_mem_pool_valid(acx_mem_block_size, acx_mem_tx_percent,
+				acx_mem_frag_percent)) {
+		adev->mem_pool.block_size = acx_mem_block_size;
+		adev->mem_pool.tx_percent = acx_mem_tx_percent;
+		adev->mem_pool.frag_percent = acx_mem_frag_percent;
+	} else {
+		pr_acx("invalid memory pool parameters, using defaults\n");
+		adev->mem_pool.tx_percent = 50;
+		adev->mem_pool.frag_percent = 75;
+	}
+	adev->mem_pool.auto_mode = !!acx_mem_pool_auto;
 
 	INIT_DELAYED_WORK(&adev->watchdog_work, acx_watchdog_work);
 
@@ -490,15 +530,80 @@ int acx_init_mechanics(acx_device_t *adev)
 int acx_free_mechanics(acx_device_t *adev)
 {
 	kfree(adev->ie_cmd_buf);
+	if (IS_MEM(adev)) {
+		kfree(adev->acx_txbuf_next);
+		adev->acx_txbuf_next = NULL;
+	}
 
 	return 0;
 }
 
 
+/* OFDM plcp signal rate codes */
+static const struct {
+	u16	bitrate;
+	u8	code;
+} acx_ofdm_plcp[] = {
+	{ 60, 0xb }, { 90, 0xf }, { 120, 0xa }, { 180, 0xe },
+	{ 240, 0x9 }, { 360, 0xd }, { 480, 0x8 }, { 540, 0xc },
+};
+
+/*
+ * acx_init_rate_tables
+ *
+ * The tx path maps mac80211 rate indices to hw_value and bitrate, and
+ * acx111 tx status rates back to rate indices. Precompute both, so
+ * these are plain table lookups per frame. rate111 gives the RATE111_x
+ * bit of each rate on both chips, for rate_basic.
+ *
+ * The rx path maps the plcp signal of each frame to a rate index.
+ * CCK/PBCC signals are the rate in 100kbps, i.e. the bitrate itself;
+ * unknown signals stay at the lowest rate.
+ */
+static void acx_init_rate_tables(acx_device_t *adev,
+				struct ieee80211_supported_band *band)
+{
+	struct ieee80211_rate *rate;
+	unsigned int key;
+	int i, j;
+
+	memset(adev->rates.index, -1, sizeof(adev->rates.index));
+	memset(adev->rates.rx_index, 0, sizeof(adev->rates.rx_index));
+	adev->rates.count = min(band->n_bitrates, ACX_MAX_RATES);
+
+	for (i = 0; i < adev->rates.count; i++) {
+		rate = &band->bitrates[i];
+		adev->rates.hw_value[i] = rate->hw_value;
+		adev->rates.bitrate[i] = rate->bitrate;
+		if (IS_ACX111(adev)) {
+			adev->rates.rate111[i] = rate->hw_value;
+			if (rate->hw_value)
+				adev->rates.index[highest_bit(rate->hw_value)] = i;
+		} else {
+			for (j = 0; j < ARRAY_SIZE(acx_bitpos2rate100); j++)
+				if (acx_bitpos2rate100[j] == rate->hw_value)
+					break;
+			adev->rates.rate111[i] = 1 << j;
+		}
+
+		key = rate->bitrate;
+		for (j = 0; j < ARRAY_SIZE(acx_ofdm_plcp); j++)
+			if (acx_ofdm_plcp[j].bitrate == rate->bitrate)
+				key = 0xf0 | acx_ofdm_plcp[j].code;
+		if (key < ARRAY_SIZE(adev->rates.rx_index))
+			adev->rates.rx_index[key] = i;
+	}
+}
+
 int acx_init_ieee80211(acx_device_t *adev, struct ieee80211_hw *hw)
 {
 	__clear_bit(IEEE80211_HW_RX_INCLUDES_FCS, hw->flags);
-	hw->queues = 1;
+
+	/* One hw tx queue per access category on acx111 pci. Mem still
+	 * transmits on queue 0 only (see acxmem_alloc_tx) and usb has
+	 * no tx queues */
+	adev->tx_ac_queues = IS_PCI(adev) && IS_ACX111(adev);
+	hw->queues = adev->tx_ac_queues ? IEEE80211_NUM_ACS : 1;
 	hw->wiphy->max_scan_ssids = 1;
 
 	/* OW TODO Check if RTS/CTS threshold can be included here */
@@ -539,6 +644,20 @@ int acx_init_ieee80211(acx_device_t *adev, struct ieee80211_hw *hw)
 		return -1;
 	}
 
+	acx_init_rate_tables(adev,
+		adev->hw->wiphy->bands[NL80211_BAND_2GHZ]);
+
+	/* Rate control in the driver instead of mac80211 (minstrel),
+	 * see acx_rc_update. Not on usb: acxusb_tx_data takes the rate
+	 * mac80211 picked, the acx111 rateset is pci/mem only */
+	adev->rc.driver = acx_rate_control && IS_ACX111(adev)
+		&& !IS_USB(adev);
+	if (adev->rc.driver)
+		__set_bit(IEEE80211_HW_HAS_RATE_CONTROL, hw->flags);
+	adev->rc.fixed = -1;
+	adev->rc.supp = BIT(adev->rates.count) - 1;
+	acx_rc_reset(adev);
+
 	return 0;
 }
 
@@ -563,6 +682,13 @@ int acx_op_add_interface(struct ieee80211_hw *ieee, struct ieee80211_VIF *vif)
 	adev->vif_type = vif_type;
 	log(L_ANY, "vif_type=%04X\n", vif_type);
 
+	/* One rate table for the device, see acx_rc_update */
+	if (adev->rc.driver && (vif_type == NL80211_IFTYPE_AP
+			|| vif_type == NL80211_IFTYPE_ADHOC)) {
+		pr_info("driver rate control is for station mode only\n");
+		goto out_unlock;
+	}
+
 	if (vif_type == NL80211_IFTYPE_MONITOR)
 		adev->vif_monitor++;
 	else if (adev->vif)
@@ -696,6 +822,16 @@ int acx_op_config(struct ieee80211_hw *hw, u32 changed)
 		changed_not_done &= ~IEEE80211_CONF_CHANGE_CHANNEL;
 	}
 
+	/* The firmware has one short and one long retry limit for all
+	 * queues, no per-AC ones */
+	if (changed & IEEE80211_CONF_CHANGE_RETRY_LIMITS) {
+		adev->short_retry = conf->short_frame_max_tx_count;
+		adev->long_retry = conf->long_frame_max_tx_count;
+		acx1xx_update_retry(adev);
+
+		changed_not_done &= ~IEEE80211_CONF_CHANGE_RETRY_LIMITS;
+	}
+
 	if (changed_not_done)
 		logf1(L_DEBUG, "changed_not_done=%08X\n", changed_not_done);
 
@@ -705,6 +841,42 @@ int acx_op_config(struct ieee80211_hw *hw, u32 changed)
 	return ret;
 }
 
+/*
+ * acx_rc_set_peer
+ *
+ * Limit the driver rate control to the rates of the AP we associated
+ * with, all of them again once we leave. acx_rc_update keeps a single
+ * table, so it is only ever used in station mode.
+ */
+static void acx_rc_set_peer(acx_device_t *adev, struct ieee80211_vif *vif,
+			struct ieee80211_bss_conf *info)
+{
+	struct ieee80211_sta *sta;
+	u32 supp = 0;
+
+	if (info->assoc) {
+		rcu_read_lock();
+		sta = ieee80211_find_sta(vif, info->bssid);
+		if (sta)
+#if CONFIG_ACX_MAC80211_VERSION >= KERNEL_VERSION(5, 19, 0)
+			supp = sta->deflink.supp_rates[NL80211_BAND_2GHZ];
+#else
+			supp = sta->supp_rates[NL80211_BAND_2GHZ];
+#endif
+		rcu_read_unlock();
+	}
+
+	supp &= BIT(adev->rates.count) - 1;
+	if (!supp)
+		supp = BIT(adev->rates.count) - 1;
+
+	acx_tx_lock(adev);
+	adev->rc.supp = supp;
+	acx_rc_reset(adev);
+	acx_tx_unlock(adev);
+	log(L_INIT, "rate control: peer rates 0x%03X\n", supp);
+}
+
 void acx_op_bss_info_changed(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 			struct ieee80211_bss_conf *info, u32 changed)
 {
@@ -713,6 +885,8 @@ void acx_op_bss_info_changed(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 	int err = -ENODEV;
 
 	struct sk_buff *beacon;
+	u16 rate_basic;
+	int i;
 
 
 	acx_sem_lock(adev);
@@ -722,6 +896,23 @@ void acx_op_bss_info_changed(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 	if (!adev->vif)
 		goto end_sem_unlock;
 
+	/* The firmware takes the basic rates with the join command:
+	 * update them before a bssid change joins, so both go in one
+	 * command. A change on its own while joined needs one more. */
+	if (changed & BSS_CHANGED_BASIC_RATES) {
+		rate_basic = 0;
+		for (i = 0; i < adev->rates.count; i++)
+			if (info->basic_rates & BIT(i))
+				rate_basic |= adev->rates.rate111[i];
+
+		if (rate_basic && rate_basic != adev->rate_basic) {
+			acx_set_rate_basic(adev, rate_basic);
+			if (!(changed & BSS_CHANGED_BSSID)
+				&& !is_zero_ether_addr(adev->bssid))
+				acx_cmd_join_bssid(adev, adev->bssid);
+		}
+	}
+
 	if (changed & BSS_CHANGED_BSSID) {
 		MAC_COPY(adev->bssid, info->bssid);
 
@@ -744,6 +935,38 @@ void acx_op_bss_info_changed(struct ieee80211_hw *hw, struct ieee80211_vif *vif,
 
 		dev_kfree_skb(beacon);
 	}
+
+	/* preamble_mode 2 (auto) follows the BSS, otherwise it is
+	 * fixed */
+	if (changed & BSS_CHANGED_ERP_PREAMBLE) {
+		adev->preamble_cur = (adev->preamble_mode == 2)
+			? info->use_short_preamble : adev->preamble_mode;
+		log(L_INIT, "preamble: %s\n",
+			adev->preamble_cur ? "short" : "long");
+	}
+
+	/* Short slot on acx111 only, acx100 is 802.11b */
+	if ((changed & BSS_CHANGED_ERP_SLOT) && IS_ACX111(adev)
+		&& info->use_short_slot != adev->short_slot)
+		acx111_set_slot_time(adev, info->use_short_slot);
+
+	/* CTS protection of OFDM frames, see acx_tx_use_rts */
+	if (changed & BSS_CHANGED_ERP_CTS_PROT) {
+		adev->cts_prot = info->use_cts_prot;
+		log(L_INIT, "cts protection: %d\n", adev->cts_prot);
+	}
+
+	/* PBCC at 5.5/11Mbps, if the BSS and our PHY both support it */
+	if (changed & BSS_CHANGED_ASSOC) {
+		adev->pbcc_cur = info->assoc
+			&& (info->assoc_capability & WLAN_CAPABILITY_PBCC)
+			&& adev->cfgopt.dot11PBCCOption;
+		log(L_INIT, "pbcc: %d\n", adev->pbcc_cur);
+
+		if (adev->rc.driver)
+			acx_rc_set_peer(adev, vif, info);
+	}
+
 	err = 0;
 
 end_sem_unlock:
@@ -964,13 +1187,41 @@ int acx_conf_tx(struct ieee80211_hw *hw, u16 queue,
 {
 	acx_device_t *adev = hw2adev(hw);
 
+	if (queue >= IEEE80211_NUM_ACS)
+		return -EINVAL;
+
 	acx_sem_lock(adev);
-    /* TODO */
+
+	/* EDCA is not supported: no firmware IE for per-queue
+	 * parameters is known. The priority between the access
+	 * categories only comes from the hw queue attributes set up in
+	 * acx111_create_dma_regions. */
+	log(L_INIT, "queue=%u: cw_min=%u cw_max=%u aifs=%u txop=%u "
+		"not programmed\n", queue, params->cw_min, params->cw_max,
+		params->aifs, params->txop);
+
 	acx_sem_unlock(adev);
 
 	return 0;
 }
 
+/*
+ * acx_op_set_rts_threshold
+ *
+ * The firmware has no RTS threshold setting: the tx path sets
+ * DESC_CTL2_RTS on longer frames, see acx_tx_use_rts. (u32) -1 turns
+ * it off.
+ */
+int acx_op_set_rts_threshold(struct ieee80211_hw *hw, u32 value)
+{
+	acx_device_t *adev = hw2adev(hw);
+
+	adev->rts_threshold = min_t(u32, value, 0xffff);
+	log(L_INIT, "rts_threshold=%u\n", adev->rts_threshold);
+
+	return 0;
+}
+
 int acx_op_set_tim(struct ieee80211_hw *hw, struct ieee80211_sta *sta, bool set)
 {
 	acx_device_t *adev = hw2adev(hw);
@@ -1008,7 +1259,7 @@ int acx_e_op_get_tx_stats(struct ieee80211_hw *hw,
 	acx_sem_lock(adev);
 
 	stats->len = 0;
-	stats->limit = TX_CNT;
+	stats->limit = adev->tx_cnt;
 	stats->count = 0;
 
 	acx_sem_unlock(adev);
@@ -1030,13 +1281,20 @@ void acx_op_tx(struct ieee80211_hw *hw, struct ieee80211_tx_control *control,
 {
 	acx_device_t *adev = hw2adev(hw);
 
-	skb_queue_tail(&adev->tx_queue, skb);
+	/* Accounted before it can complete, may stop the queues */
+	acx_tx_backlog_add(adev, skb->len);
 
-	ieee80211_queue_work(adev->hw, &adev->tx_work);
+	/* Try to put the frame directly on the ring first. If that's
+	 * not possible, defer it to the tx_work */
+	if (acx_tx_direct(adev, skb) == 0)
+		goto out;
+
+	skb_queue_tail(&adev->tx_queue, skb);
 
-	if (skb_queue_len(&adev->tx_queue) >= ACX_TX_QUEUE_MAX_LENGTH)
-		acx_stop_queue(adev->hw, NULL);
+	if (!work_pending(&adev->tx_work))
+		ieee80211_queue_work(adev->hw, &adev->tx_work);
 
+out:
 	#if CONFIG_ACX_MAC80211_VERSION < KERNEL_VERSION(2, 6, 39)
 	return 0;
 	#else
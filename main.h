@@ -4,8 +4,6 @@
 /* Minutes to wait until next radio recalibration: */
 #define RECALIB_PAUSE	5
 
-extern struct ieee80211_rate acx111_rates[];
-extern const int acx111_rates_sizeof;
 extern const u8 bitpos2genframe_txrate[];
 
 struct ieee80211_hw* acx_alloc_hw(const struct ieee80211_ops *hw_ops);
@@ -43,6 +41,7 @@ int acx_conf_tx(struct ieee80211_hw *hw, struct ieee80211_vif *vif, u16 queue,
 int acx_conf_tx(struct ieee80211_hw *hw, u16 queue,
 		const struct ieee80211_tx_queue_params *params);
 #endif
+int acx_op_set_rts_threshold(struct ieee80211_hw *hw, u32 value);
 int acx_op_set_tim(struct ieee80211_hw *hw, struct ieee80211_sta *sta, bool set);
 int acx_op_get_stats(struct ieee80211_hw *hw,
 		struct ieee80211_low_level_stats *stats);
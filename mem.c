@@ -179,110 +179,115 @@ void acxmem_dump_mem(acx_device_t *adev, u32 start, int length)
  * ==================================================
  */
 
+/*
+ * Slave memory bursts: in auto-increment mode (SLV_MEM_CTL = 1) the acx
+ * advances SLV_MEM_ADDR by one word after each SLV_MEM_DATA access, so
+ * a burst sets the address and waits for it once, then streams the
+ * words. The single word accessors (read_slavemem32 ...) switch back
+ * to basic mode themselves.
+ */
+static inline void acxmem_burst_start(acx_device_t *adev, u32 address)
+{
+	write_reg32(adev, IO_ACX_SLV_MEM_CTL, 1);
+	write_reg32(adev, IO_ACX_SLV_MEM_ADDR, address);
+	udelay(10);
+}
+
+static inline void acxmem_burst_end(acx_device_t *adev)
+{
+	write_reg32(adev, IO_ACX_SLV_MEM_CTL, 0);
+}
+
 /*
  * Copy from slave memory
  *
- * TODO - rewrite using address autoincrement, handle partial words
+ * One burst from the word containing source; leading and trailing
+ * partial words are cut to the requested bytes. destination needs no
+ * alignment.
  */
 /* = static */
 void acxmem_copy_from_slavemem(acx_device_t *adev, u8 *destination,
 			u32 source, int count)
 {
-	u32 tmp = 0;
-	u8 *ptmp = (u8 *) &tmp;
+	u32 tmp;
+	int skip = source & 3, n;
 
 	ACXMEM_WARN_NOT_SPIN_LOCKED;
 
-	/*
-	 * Right now I'm making the assumption that the destination is
-	 * aligned, but I'd better check.
-	 */
-	if ((uintptr_t) destination & 3) {
-		pr_acx("copy_from_slavemem: warning!  destination not word-aligned!\n");
+	if (count <= 0)
+		return;
+
+	acxmem_burst_start(adev, source & ~3);
+
+	if (skip) {
+		tmp = read_reg32(adev, IO_ACX_SLV_MEM_DATA);
+		n = min(4 - skip, count);
+		memcpy(destination, (u8 *) &tmp + skip, n);
+		destination += n;
+		count -= n;
 	}
 
 	while (count >= 4) {
-		write_reg32(adev, IO_ACX_SLV_MEM_ADDR, source);
-		udelay (10);
-		*((u32 *) destination) = read_reg32(adev, IO_ACX_SLV_MEM_DATA);
-		count -= 4;
-		source += 4;
+		tmp = read_reg32(adev, IO_ACX_SLV_MEM_DATA);
+		memcpy(destination, &tmp, 4);
 		destination += 4;
+		count -= 4;
 	}
 
-	/*
-	 * If the word reads above didn't satisfy the count, read one
-	 * more word and transfer a byte at a time until the request
-	 * is satisfied.
-	 */
 	if (count) {
-		write_reg32(adev, IO_ACX_SLV_MEM_ADDR, source);
-		udelay (10);
 		tmp = read_reg32(adev, IO_ACX_SLV_MEM_DATA);
-		while (count--) {
-			*destination++ = *ptmp++;
-		}
+		memcpy(destination, &tmp, count);
 	}
 
+	acxmem_burst_end(adev);
 }
 
 /*
  * Copy to slave memory
  *
- * TODO - rewrite using autoincrement, handle partial words
+ * Leading and trailing partial words are merged into the words on the
+ * acx (read-modify-write), the whole words in between go in one burst.
+ * source needs no alignment.
  */
 /* = static */
 void acxmem_copy_to_slavemem(acx_device_t *adev, u32 destination,
 			u8 *source, int count)
 {
-	u32 tmp = 0;
-	u8* ptmp = (u8 *) &tmp;
-	static u8 src[512]; /* make static to avoid huge stack objects */
+	u32 tmp;
+	int skip = destination & 3, n;
 
 	ACXMEM_WARN_NOT_SPIN_LOCKED;
 
-	/*
-	 * For now, make sure the source is word-aligned by copying it
-	 * to a word-aligned buffer.  Someday rewrite to avoid the
-	 * extra copy.
-	 */
-	if (count > sizeof(src)) {
-		pr_acx("copy_to_slavemem: Warning! buffer overflow!\n");
-		count = sizeof(src);
+	if (count <= 0)
+		return;
+
+	if (skip) {
+		n = min(4 - skip, count);
+		tmp = read_slavemem32(adev, destination & ~3);
+		memcpy((u8 *) &tmp + skip, source, n);
+		write_slavemem32(adev, destination & ~3, tmp);
+		destination += n;
+		source += n;
+		count -= n;
 	}
-	memcpy(src, source, count);
-	source = src;
 
-	while (count >= 4) {
-		write_reg32(adev, IO_ACX_SLV_MEM_ADDR, destination);
-		udelay (10);
-		write_reg32(adev, IO_ACX_SLV_MEM_DATA, *((u32 *) source));
-		count -= 4;
-		source += 4;
-		destination += 4;
+	if (count >= 4) {
+		acxmem_burst_start(adev, destination);
+		while (count >= 4) {
+			memcpy(&tmp, source, 4);
+			write_reg32(adev, IO_ACX_SLV_MEM_DATA, tmp);
+			destination += 4;
+			source += 4;
+			count -= 4;
+		}
+		acxmem_burst_end(adev);
 	}
 
-	/*
-	 * If there are leftovers read the next word from the acx and
-	 * merge in what they want to write.
-	 */
 	if (count) {
-		write_reg32(adev, IO_ACX_SLV_MEM_ADDR, destination);
-		udelay (10);
-		tmp = read_reg32(adev, IO_ACX_SLV_MEM_DATA);
-		while (count--) {
-			*ptmp++ = *source++;
-		}
-		/*
-		 * reset address in case we're currently in
-		 * auto-increment mode
-		 */
-		write_reg32(adev, IO_ACX_SLV_MEM_ADDR, destination);
-		udelay (10);
-		write_reg32(adev, IO_ACX_SLV_MEM_DATA, tmp);
-		udelay (10);
+		tmp = read_slavemem32(adev, destination);
+		memcpy(&tmp, source, count);
+		write_slavemem32(adev, destination, tmp);
 	}
-
 }
 
 /*
@@ -295,29 +300,20 @@ void acxmem_chaincopy_to_slavemem(acx_device_t *adev, u32 destination,
 				u8 *source, int count)
 {
 	u32 val;
-	u32 *data = (u32 *) source;
-	static u8 aligned_source[WLAN_A4FR_MAXLEN_WEP_FCS];
 
 	ACXMEM_WARN_NOT_SPIN_LOCKED;
 
 	/*
-	 * Warn if the pointers don't look right.  Destination must
-	 * fit in [23:5] with zero elsewhere and source should be 32
-	 * bit aligned.  This should never happen since we're in
-	 * control of both, but I want to know about it if it does.
+	 * Warn if the pointer doesn't look right.  Destination must
+	 * fit in [23:5] with zero elsewhere.  This should never
+	 * happen since we're in control of it, but I want to know
+	 * about it if it does.  The source may be unaligned, the
+	 * network stack sends such things.
 	 */
 	if ((destination & 0x00ffffe0) != destination) {
 		pr_acx("chaincopy: destination block 0x%04x not aligned!\n",
 			destination);
 	}
-	if (count > sizeof aligned_source) {
-		pr_err("chaincopy_to_slavemem overflow!\n");
-		count = sizeof aligned_source;
-	}
-	if ((uintptr_t) source & 3) {
-		memcpy(aligned_source, source, count);
-		data = (u32 *) aligned_source;
-	}
 
 	/*
 	 * SLV_MEM_CTL[17:16] = memory block chain mode with
@@ -341,14 +337,21 @@ void acxmem_chaincopy_to_slavemem(acx_device_t *adev, u32 destination,
 	acx_writel (val, adev->iobase + ACX_SLV_MEM_ADDR);
 
 	/*
-	 * Write the data to the slave data register, rounding up to
-	 * the end of the word containing the last byte (hence the >
-	 * 0)
+	 * Write the data to the slave data register, word by word
+	 * straight from the (maybe unaligned) source; the last
+	 * partial word is padded with zeros.
 	 */
-	while (count > 0) {
-		acx_writel (*data++, adev->iobase + ACX_SLV_MEM_DATA);
+	while (count >= 4) {
+		memcpy(&val, source, 4);
+		acx_writel (val, adev->iobase + ACX_SLV_MEM_DATA);
+		source += 4;
 		count -= 4;
 	}
+	if (count > 0) {
+		val = 0;
+		memcpy(&val, source, count);
+		acx_writel (val, adev->iobase + ACX_SLV_MEM_DATA);
+	}
 
 }
 
@@ -363,30 +366,18 @@ void acxmem_chaincopy_from_slavemem(acx_device_t *adev, u8 *destination,
 				u32 source, int count)
 {
 	u32 val;
-	u32 *data = (u32 *) destination;
-	static u8 aligned_destination[WLAN_A4FR_MAXLEN_WEP_FCS];
-	int saved_count = count;
 
 	ACXMEM_WARN_NOT_SPIN_LOCKED;
 
 	/*
-	 * Warn if the pointers don't look right.  Destination must
-	 * fit in [23:5] with zero elsewhere and source should be 32
-	 * bit aligned.  Turns out the network stack sends unaligned
-	 * things, so fix them before copying to the ACX.
+	 * Warn if the pointer doesn't look right.  Source must fit in
+	 * [23:5] with zero elsewhere.  The destination may be
+	 * unaligned.
 	 */
 	if ((source & 0x00ffffe0) != source) {
 		pr_acx("chaincopy: source block 0x%04x not aligned!\n", source);
 		acxmem_dump_mem(adev, 0, 0x10000);
 	}
-	if ((uintptr_t) destination & 3) {
-		/* printk ("acx chaincopy: data destination not word aligned!\n"); */
-		data = (u32 *) aligned_destination;
-		if (count > sizeof aligned_destination) {
-			pr_err("chaincopy_from_slavemem overflow!\n");
-			count = sizeof aligned_destination;
-		}
-	}
 
 	/*
 	 * SLV_MEM_CTL[17:16] = memory block chain mode with auto-increment
@@ -409,21 +400,19 @@ void acxmem_chaincopy_from_slavemem(acx_device_t *adev, u8 *destination,
 	acx_writel (val, adev->iobase + ACX_SLV_MEM_ADDR);
 
 	/*
-	 * Read the data from the slave data register, rounding up to
-	 * the end of the word containing the last byte (hence the >
-	 * 0)
+	 * Read the data from the slave data register, word by word
+	 * straight into the (maybe unaligned) destination; of the
+	 * last partial word only the requested bytes are stored.
 	 */
-	while (count > 0) {
-		*data++ = acx_readl (adev->iobase + ACX_SLV_MEM_DATA);
+	while (count >= 4) {
+		val = acx_readl (adev->iobase + ACX_SLV_MEM_DATA);
+		memcpy(destination, &val, 4);
+		destination += 4;
 		count -= 4;
 	}
-
-	/*
-	 * If the destination wasn't aligned, we would have saved it
-	 * in the aligned buffer, so copy it where it should go.
-	 */
-	if ((uintptr_t) destination & 3) {
-		memcpy(destination, aligned_destination, saved_count);
+	if (count > 0) {
+		val = acx_readl (adev->iobase + ACX_SLV_MEM_DATA);
+		memcpy(destination, &val, count);
 	}
 }
 
@@ -877,7 +866,7 @@ int acxmem_dbgfs_diag_output(struct seq_file *file,
 	seq_printf(file, "** Rx buf **\n");
 	rxdesc = adev->hw_rx_queue.acxdescinfo.start;
 	if (rxdesc)
-		for (i = 0; i < RX_CNT; i++) {
+		for (i = 0; i < adev->rx_cnt; i++) {
 			rtl = (i == adev->hw_rx_queue.tail) ? " [tail]" : "";
 			Ctl_8 = read_slavemem8(adev, (uintptr_t)
 					&(rxdesc->Ctl_8));
@@ -924,7 +913,7 @@ int acxmem_dbgfs_diag_output(struct seq_file *file,
 
 	txdesc = adev->hw_tx_queue[0].acxdescinfo.start;
 	if (txdesc) {
-		for (i = 0; i < TX_CNT; i++) {
+		for (i = 0; i < adev->tx_cnt; i++) {
 			thd = (i == adev->hw_tx_queue[0].head) ? " [head]" : "";
 			ttl = (i == adev->hw_tx_queue[0].tail) ? " [tail]" : "";
 			acxmem_copy_from_slavemem(adev, (u8 *) &txd,
@@ -1047,10 +1036,24 @@ int acxmem_dbgfs_diag_output(struct seq_file *file,
  * ==================================================
  */
 
+/*
+ * Host copy of an rx descriptor, ACXMemPtr to Ctl_8: everything the
+ * rx path needs, in one burst
+ */
+static u8 acxmem_read_rxdesc(acx_device_t *adev, rxacxdesc_t *rxdesc,
+			rxacxdesc_t *desc)
+{
+	acxmem_copy_from_slavemem(adev, (u8 *) &desc->ACXMemPtr,
+		(uintptr_t) &rxdesc->ACXMemPtr,
+		offsetof(rxacxdesc_t, rate) - offsetof(rxacxdesc_t, ACXMemPtr));
+
+	return desc->Ctl_8;
+}
+
 void acxmem_process_rxdesc(acx_device_t *adev)
 {
 	rxhostdesc_t *hostdesc;
-	rxacxdesc_t *rxdesc;
+	rxacxdesc_t *rxdesc, desc;
 	unsigned count, tail;
 	u32 addr;
 	u8 Ctl_8;
@@ -1063,12 +1066,12 @@ void acxmem_process_rxdesc(acx_device_t *adev)
 	 * rx_tail and the full descriptor we're supposed to
 	 * handle. */
 	tail = adev->hw_rx_queue.tail;
-	count = RX_CNT;
+	count = adev->rx_cnt;
 	while (1) {
 		hostdesc = &adev->hw_rx_queue.hostdescinfo.start[tail];
 		rxdesc = &adev->hw_rx_queue.acxdescinfo.start[tail];
 		/* advance tail regardless of outcome of the below test */
-		tail = (tail + 1) % RX_CNT;
+		tail = (tail + 1) % adev->rx_cnt;
 
 		/*
 		 * Unlike the PCI interface, where the ACX can write
@@ -1076,10 +1079,11 @@ void acxmem_process_rxdesc(acx_device_t *adev)
 		 * memory interface we have to pull these.  All we
 		 * really need to do is check the Ctl_8 field in the
 		 * rx descriptor on the ACX, which should be
-		 * 0x11000000 if we should process it.
+		 * 0x11000000 if we should process it. The length and
+		 * buffer pointer come along in the same burst.
 		 */
 		Ctl_8 = hostdesc->hd.Ctl_16
-			= read_slavemem8(adev, (uintptr_t) &(rxdesc->Ctl_8));
+			= acxmem_read_rxdesc(adev, rxdesc, &desc);
 					
 		if ((Ctl_8 & DESC_CTL_HOSTOWN) && (Ctl_8 & DESC_CTL_ACXDONE))
 			break; /* found it! */
@@ -1102,8 +1106,7 @@ void acxmem_process_rxdesc(acx_device_t *adev)
 			/*
 			 * slave interface - pull data now
 			 */
-			hostdesc->hd.length = read_slavemem16(adev,
-					(uintptr_t) &(rxdesc->total_length));
+			hostdesc->hd.length = desc.total_length;
 
 			/*
 			 * hostdesc->data is an rxbuffer_t, which
@@ -1112,8 +1115,7 @@ void acxmem_process_rxdesc(acx_device_t *adev)
 			 * information takes up an additional 12
 			 * bytes, so add that to the length we copy.
 			 */
-			addr = read_slavemem32(adev,
-					(uintptr_t) &(rxdesc->ACXMemPtr));
+			addr = desc.ACXMemPtr.v;
 			if (addr) {
 				/*
 				 * How can &(rxdesc->ACXMemPtr) above
@@ -1157,13 +1159,14 @@ void acxmem_process_rxdesc(acx_device_t *adev)
 		hostdesc = &adev->hw_rx_queue.hostdescinfo.start[tail];
 		rxdesc = &adev->hw_rx_queue.acxdescinfo.start[tail];
 
-		Ctl_8 = hostdesc->hd.Ctl_16 = read_slavemem8(adev, (uintptr_t) &(rxdesc->Ctl_8));
+		Ctl_8 = hostdesc->hd.Ctl_16
+			= acxmem_read_rxdesc(adev, rxdesc, &desc);
 
 		/* if next descriptor is empty, then bail out */
 		if (!(Ctl_8 & DESC_CTL_HOSTOWN) || !(Ctl_8 & DESC_CTL_ACXDONE))
 			break;
 
-		tail = (tail + 1) % RX_CNT;
+		tail = (tail + 1) % adev->rx_cnt;
 	}
 	end:
 		adev->hw_rx_queue.tail = tail;
@@ -1182,12 +1185,35 @@ static int acxmem_get_txbuf_space_needed(acx_device_t *adev,
 	return (blocks_needed);
 }
 
+static inline u32 acxmem_txbuf_addr(acx_device_t *adev, unsigned int i)
+{
+	return adev->acx_txbuf_start + i * adev->memblocksize;
+}
+
+static inline unsigned int acxmem_txbuf_index(acx_device_t *adev, u32 addr)
+{
+	return (addr - adev->acx_txbuf_start) / adev->memblocksize;
+}
+
+/* Link word of a block pointing to block i, see acxmem_init_acx_txbuf */
+static inline u32 acxmem_txbuf_link(acx_device_t *adev, unsigned int i)
+{
+	return (i == ACX_TXBUF_END) ? 0x02000000
+		: acxmem_txbuf_addr(adev, i) >> 5;
+}
+
 /*
  * Return an acx pointer to the next transmit data block.
+ *
+ * The chain is followed in the host copy, acx_txbuf_next: the free
+ * list blocks are already linked on the acx, so the only slave memory
+ * access is marking the last block of the allocation as the end.
  */
 u32 acxmem_allocate_acx_txbuf_space(acx_device_t *adev, int count)
 {
-	u32 block, next, last_block;
+	u32 block;
+	unsigned int last;
+	int n;
 	int blocks_needed;
 
 	/*
@@ -1196,54 +1222,33 @@ u32 acxmem_allocate_acx_txbuf_space(acx_device_t *adev, int count)
 	 */
 	blocks_needed = acxmem_get_txbuf_space_needed(adev, count);
 
-	if (blocks_needed <= adev->acx_txbuf_blocks_free) {
-		/*
-		 * Take blocks at the head of the free list.
-		 */
-		last_block = block = adev->acx_txbuf_free;
+	if (!blocks_needed || blocks_needed > adev->acx_txbuf_blocks_free)
+		return 0;
 
-		/*
-		 * Follow block pointers through the requested number
-		 * of blocks both to find the new head of the free
-		 * list and to set the flags for the blocks
-		 * appropriately.
-		 */
-		while (blocks_needed--) {
-			/*
-			 * Keep track of the last block of the allocation
-			 */
-			last_block = adev->acx_txbuf_free;
-
-			/*
-			 * Make sure the end control flag is not set.
-			 */
-			next = read_slavemem32(adev, adev->acx_txbuf_free) & 0x7ffff;
-			write_slavemem32(adev, adev->acx_txbuf_free, next);
-
-			/*
-			 * Update the new head of the free list
-			 */
-			adev->acx_txbuf_free = next << 5;
-			adev->acx_txbuf_blocks_free--;
-
-		}
+	/*
+	 * Take blocks at the head of the free list.
+	 */
+	block = adev->acx_txbuf_free;
+	last = acxmem_txbuf_index(adev, block);
+	for (n = 1; n < blocks_needed; n++)
+		last = adev->acx_txbuf_next[last];
 
-		/*
-		 * Flag the last block both by clearing out the next
-		 * pointer and marking the control field.
-		 */
-		write_slavemem32(adev, last_block, 0x02000000);
+	/*
+	 * The block after the last one is the new head of the free
+	 * list. If we're out of buffers make sure the free list
+	 * pointer is NULL.
+	 */
+	adev->acx_txbuf_blocks_free -= blocks_needed;
+	adev->acx_txbuf_free = adev->acx_txbuf_blocks_free
+		? acxmem_txbuf_addr(adev, adev->acx_txbuf_next[last]) : 0;
 
-		/*
-		 * If we're out of buffers make sure the free list
-		 * pointer is NULL
-		 */
-		if (!adev->acx_txbuf_blocks_free) {
-			adev->acx_txbuf_free = 0;
-		}
-	} else {
-		block = 0;
-	}
+	/*
+	 * Flag the last block both by clearing out the next
+	 * pointer and marking the control field.
+	 */
+	adev->acx_txbuf_next[last] = ACX_TXBUF_END;
+	write_slavemem32(adev, acxmem_txbuf_addr(adev, last),
+			acxmem_txbuf_link(adev, ACX_TXBUF_END));
 
 	return block;
 }
@@ -1264,11 +1269,22 @@ void acxmem_dealloc_tx(acx_device_t *adev, tx_t *tx_opaque) {
 	 */
 	txacxdesc_t *txdesc = (txacxdesc_t*) tx_opaque;
 	txacxdesc_t tmptxdesc;
+	txhostdesc_t *hostdesc;
 	int index;
 
 	acxmem_lock_flags;
 	acxmem_lock();
 
+	index = ((u8*) txdesc - (u8*) adev->hw_tx_queue[0].acxdescinfo.start) /
+		adev->hw_tx_queue[0].acxdescinfo.size;
+
+	/* Give back the txbuf blocks reserved by acxmem_alloc_tx */
+	hostdesc = &adev->hw_tx_queue[0].hostdescinfo.start[index * 2];
+	if (hostdesc->acx_txbuf) {
+		acxmem_reclaim_acx_txbuf_space(adev, hostdesc->acx_txbuf);
+		hostdesc->acx_txbuf = 0;
+	}
+
 	memset (&tmptxdesc, 0, sizeof(tmptxdesc));
 	tmptxdesc.Ctl_8 = DESC_CTL_HOSTOWN | DESC_CTL_FIRSTFRAG;
 	tmptxdesc.u.r1.rate = 0x0a;
@@ -1284,11 +1300,10 @@ void acxmem_dealloc_tx(acx_device_t *adev, tx_t *tx_opaque) {
 	 * This is only called immediately after we've allocated, so
 	 * we should be able to set the head back to this descriptor.
 	 */
-	index = ((u8*) txdesc - (u8*) adev->hw_tx_queue[0].acxdescinfo.start) /
-		adev->hw_tx_queue[0].acxdescinfo.size;
 	pr_info("acx_dealloc: moving head from %d to %d\n",
 	        adev->hw_tx_queue[0].head, index);
 	adev->hw_tx_queue[0].head = index;
+	adev->hw_tx_queue[0].free++;
 
 	acxmem_unlock();
 
@@ -1298,6 +1313,11 @@ void acxmem_dealloc_tx(acx_device_t *adev, tx_t *tx_opaque) {
  * acxmem_l_alloc_tx
  * Actually returns a txdesc_t* ptr
  *
+ * The txbuf blocks for len bytes are reserved together with the
+ * descriptor, under the same lock, and kept in the hostdesc for
+ * _acx_tx_data. If either is short nothing is claimed, and NULL lets
+ * acx_tx_queue_go back off with -EBUSY.
+ *
  * FIXME: in case of fragments, should allocate multiple descrs
  * after figuring out how many we need and whether we still have
  * sufficiently many.
@@ -1309,12 +1329,14 @@ tx_t *acxmem_alloc_tx(acx_device_t *adev, unsigned int len) {
 	u8 ctl8;
 	static int txattempts = 0;
 	int blocks_needed;
+	u32 addr;
 	acxmem_lock_flags;
 
 
 	acxmem_lock();
 
 	if (unlikely(!adev->hw_tx_queue[0].free)) {
+		adev->tx_stats.txdesc_short++;
 		log(L_ANY, "BUG: no free txdesc left\n");
 		/*
 		 * Probably the ACX ignored a transmit attempt and now
@@ -1362,10 +1384,14 @@ tx_t *acxmem_alloc_tx(acx_device_t *adev, unsigned int len) {
 	 *
 	 * Reporting NOT_OK here shouldn't be done neither according
 	 * to mac80211, but it seems to work better here.
+	 *
+	 * The blocks are only reserved below, once the descriptor
+	 * is known to be free.
 	 */
 
 	blocks_needed=acxmem_get_txbuf_space_needed(adev, len);
 	if (!(blocks_needed <= adev->acx_txbuf_blocks_free)) {
+		adev->tx_stats.txbuf_short++;
 		txdesc = NULL;
 		log(L_BUFT, "!(blocks_needed <= adev->acx_txbuf_blocks_free), "
 			"len=%i, blocks_needed=%i, acx_txbuf_blocks_free=%i: "
@@ -1398,9 +1424,19 @@ tx_t *acxmem_alloc_tx(acx_device_t *adev, unsigned int len) {
 		 * ring buffer already full */
 		log(L_ANY, "BUG: tx_head:%d Ctl8:0x%02X - failed to find free txdesc\n",
 			head, ctl8);
+		adev->tx_stats.txdesc_short++;
+		txdesc = NULL;
+		goto end;
+	}
+
+	/* Reserve the txbuf blocks before the descriptor is claimed */
+	addr = acxmem_allocate_acx_txbuf_space(adev, len);
+	if (unlikely(!addr)) {
+		adev->tx_stats.txbuf_short++;
 		txdesc = NULL;
 		goto end;
 	}
+	adev->hw_tx_queue[0].hostdescinfo.start[head * 2].acx_txbuf = addr;
 
 	/* Needed in case txdesc won't be eventually submitted for tx */
 	write_slavemem8(adev, (uintptr_t) &(txdesc->Ctl_8), DESC_CTL_ACXDONE_HOSTOWN);
@@ -1409,7 +1445,7 @@ tx_t *acxmem_alloc_tx(acx_device_t *adev, unsigned int len) {
 	log(L_BUFT, "tx: got desc %u, %u remain\n", head, adev->hw_tx_queue[0].free);
 
 	/* returning current descriptor, so advance to next free one */
-	adev->hw_tx_queue[0].head = (head + 1) % TX_CNT;
+	adev->hw_tx_queue[0].head = (head + 1) % adev->tx_cnt;
 
 	end:
 
@@ -1426,48 +1462,59 @@ tx_t *acxmem_alloc_tx(acx_device_t *adev, unsigned int len) {
  * point to the newly freed memory.  This routine gets called in
  * interrupt context, so it shouldn't block to protect the integrity
  * of the linked list.  The ISR already holds the lock.
+ *
+ * The pointers are followed in the host copy; only the new link of
+ * the last block is written to the acx.
  */
 void acxmem_reclaim_acx_txbuf_space(acx_device_t *adev, u32 blockptr)
 {
-	u32 cur, last, next;
-
-	if ((blockptr >= adev->acx_txbuf_start) &&
-		(blockptr <= adev->acx_txbuf_start +
-		(adev->acx_txbuf_numblocks - 1)	* adev->memblocksize)) {
-		cur = blockptr;
-		do {
-			last = cur;
-			next = read_slavemem32(adev, cur);
-
-			/*
-			 * Advance to the next block in this allocation
-			 */
-			cur = (next & 0x7ffff) << 5;
-
-			/*
-			 * This block now counts as free.
-			 */
-			adev->acx_txbuf_blocks_free++;
-		} while (!(next & 0x02000000));
-
-		/*
-		 * last now points to the last block of that
-		 * allocation.  Update the pointer in that block to
-		 * point to the free list and reset the free list to
-		 * the first block of the free call.  If there were no
-		 * free blocks, make sure the new end of the list
-		 * marks itself as truly the end.
-		 */
-		if (adev->acx_txbuf_free) {
-			write_slavemem32(adev, last, adev->acx_txbuf_free >> 5);
-		} else {
-			write_slavemem32(adev, last, 0x02000000);
+	unsigned int last;
+	int n;
+
+	if ((blockptr < adev->acx_txbuf_start) ||
+		(blockptr > adev->acx_txbuf_start +
+		(adev->acx_txbuf_numblocks - 1)	* adev->memblocksize))
+		return;
+
+	last = acxmem_txbuf_index(adev, blockptr);
+	for (n = 1; adev->acx_txbuf_next[last] != ACX_TXBUF_END; n++) {
+		if (unlikely(n >= adev->acx_txbuf_numblocks)) {
+			pr_acx("BUG: tx buffer chain at 0x%04x loops\n",
+				blockptr);
+			return;
 		}
-		adev->acx_txbuf_free = blockptr;
+		last = adev->acx_txbuf_next[last];
 	}
 
+	/*
+	 * last now points to the last block of that allocation.
+	 * Update the pointer in that block to point to the free list
+	 * and reset the free list to the first block of the free
+	 * call.  If there were no free blocks, the last block stays
+	 * marked as the end of the list.
+	 */
+	if (adev->acx_txbuf_free) {
+		adev->acx_txbuf_next[last] =
+			acxmem_txbuf_index(adev, adev->acx_txbuf_free);
+		write_slavemem32(adev, acxmem_txbuf_addr(adev, last),
+			acxmem_txbuf_link(adev, adev->acx_txbuf_next[last]));
+	}
+	adev->acx_txbuf_free = blockptr;
+	adev->acx_txbuf_blocks_free += n;
 }
 
+/*
+ * The host copy of a freshly linked pool: each block points to the
+ * following one, the last one is the end.
+ */
+static void acxmem_init_txbuf_next(acx_device_t *adev)
+{
+	int i;
+
+	for (i = 0; i < adev->acx_txbuf_numblocks - 1; i++)
+		adev->acx_txbuf_next[i] = i + 1;
+	adev->acx_txbuf_next[i] = ACX_TXBUF_END;
+}
 
 /*
  * Initialize the pieces managing the transmit buffer pool on the ACX.
@@ -1475,6 +1522,9 @@ void acxmem_reclaim_acx_txbuf_space(acx_device_t *adev, u32 blockptr)
  * reserved at the beginning of each block.  The upper 13 bits are a
  * control field, of which only 0x02000000 has any meaning.  The lower
  * 19 bits are the address of the next block divided by 32.
+ *
+ * acx_txbuf_next mirrors these links as block indices, so allocation
+ * and reclaim don't need to read them back from the acx.
  */
 void acxmem_init_acx_txbuf(acx_device_t *adev)
 {
@@ -1494,6 +1544,7 @@ void acxmem_init_acx_txbuf(acx_device_t *adev)
 	 * leave it alone.  This is only ever called after a firmware
 	 * reset, so the ACX memory is in the state we want.
 	 */
+	acxmem_init_txbuf_next(adev);
 
 }
 
@@ -1522,6 +1573,7 @@ void acxmem_init_acx_txbuf2(acx_device_t *adev)
 
 	adev->acx_txbuf_free = adev->acx_txbuf_start;
 	adev->acx_txbuf_blocks_free = adev->acx_txbuf_numblocks;
+	acxmem_init_txbuf_next(adev);
 
 }
 #endif
@@ -1536,7 +1588,7 @@ acxmem_get_txhostdesc(acx_device_t *adev, txacxdesc_t* txdesc)
 		return NULL;
 	}
 	index /= adev->tx.desc_size;
-	if (unlikely(ACX_DEBUG && (index >= TX_CNT))) {
+	if (unlikely(ACX_DEBUG && (index >= adev->tx_cnt))) {
 		pr_info("bad txdesc ptr %p\n", txdesc);
 		return NULL;
 	}
@@ -1811,12 +1863,16 @@ static irqreturn_t acxmem_interrupt(int irq, void *dev_id)
 
 static const struct ieee80211_ops acxmem_hw_ops = {
 	.tx		= acx_op_tx,
+#if ACX_TXQ
+	.wake_tx_queue	= acx_op_wake_tx_queue,
+#endif
 	.conf_tx	= acx_conf_tx,
 	.start		= acx_op_start,
 	.stop		= acx_op_stop,
 	.config		= acx_op_config,
 	.set_key	= acx_op_set_key,
 	.get_stats	= acx_op_get_stats,
+	.set_rts_threshold	= acx_op_set_rts_threshold,
 
 	.add_interface		= acx_op_add_interface,
 	.remove_interface	= acx_op_remove_interface,
@@ -2053,7 +2109,7 @@ int acx111pci_ioctl_info(struct ieee80211_hw *hw,
 
 	/* loop over complete receive pool */
 	if (rxdesc)
-		for (i = 0; i < RX_CNT; i++) {
+		for (i = 0; i < adev->rx_cnt; i++) {
 			pr_acx("\ndump internal rxdesc %d:\n"
 				"mem pos %p\n"
 				"next 0x%X\n"
@@ -2076,7 +2132,7 @@ int acx111pci_ioctl_info(struct ieee80211_hw *hw,
 
 		/* loop over complete receive pool */
 		if (rxhostdesc)
-		for (i = 0; i < RX_CNT; i++) {
+		for (i = 0; i < adev->rx_cnt; i++) {
 			pr_acx("\ndump host rxdesc %d:\n"
 				"mem pos %p\n"
 				"buffer mem pos 0x%X\n"
@@ -2101,7 +2157,7 @@ int acx111pci_ioctl_info(struct ieee80211_hw *hw,
 
 		/* loop over complete transmit pool */
 		if (txdesc)
-		for (i = 0; i < TX_CNT; i++) {
+		for (i = 0; i < adev->tx_cnt; i++) {
 			pr_acx("\ndump internal txdesc %d:\n"
 				"size 0x%X\n"
 				"mem pos %p\n"
@@ -2133,7 +2189,7 @@ int acx111pci_ioctl_info(struct ieee80211_hw *hw,
 
 		/* loop over complete host send pool */
 		if (txhostdesc)
-		for (i = 0; i < TX_CNT * 2; i++) {
+		for (i = 0; i < adev->tx_cnt * 2; i++) {
 			pr_acx("\ndump host txdesc %d:\n"
 				"mem pos %p\n"
 				"buffer mem pos 0x%X\n"
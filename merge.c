@@ -248,7 +248,7 @@ static int acx_create_rx_host_desc_queue(acx_device_t *adev)
 
 	/* allocate the RX host descriptor queue pool, if not already done */
 	if (!adev->hw_rx_queue.hostdescinfo.start) {
-		adev->hw_rx_queue.hostdescinfo.size = RX_CNT * sizeof(*hostdesc);
+		adev->hw_rx_queue.hostdescinfo.size = adev->rx_cnt * sizeof(*hostdesc);
 		rc = acx_allocate(adev, adev->hw_rx_queue.hostdescinfo.size,
 			&adev->hw_rx_queue.hostdescinfo.phy,
 			(void**) &adev->hw_rx_queue.hostdescinfo.start, "rxhostdesc_start");
@@ -265,7 +265,7 @@ static int acx_create_rx_host_desc_queue(acx_device_t *adev)
 	/* allocate Rx buffer pool which will be used by the acx
 	 * to store the whole content of the received frames in it */
 	if (!adev->hw_rx_queue.bufinfo.start) {
-		adev->hw_rx_queue.bufinfo.size = RX_CNT * RX_BUFFER_SIZE;
+		adev->hw_rx_queue.bufinfo.size = adev->rx_cnt * RX_BUFFER_SIZE;
 		rc = acx_allocate(adev, adev->hw_rx_queue.bufinfo.size,
 			&adev->hw_rx_queue.bufinfo.phy,
 			&adev->hw_rx_queue.bufinfo.start, "rxbuf_start");
@@ -281,7 +281,7 @@ static int acx_create_rx_host_desc_queue(acx_device_t *adev)
 	/* don't make any popular C programming pointer arithmetic
 	 * mistakes here, otherwise I'll kill you...  (and don't dare
 	 * asking me why I'm warning you about that...) */
-	for (i = 0; i < RX_CNT; i++) {
+	for (i = 0; i < adev->rx_cnt; i++) {
 		hostdesc->data = rxbuf;
 		hostdesc->hd.data_phy = cpu2acx(rxbuf_phy);
 		hostdesc->hd.length = cpu_to_le16(RX_BUFFER_SIZE);
@@ -312,9 +312,11 @@ static int acx_create_tx_host_desc_queue(acx_device_t *adev, struct hw_tx_queue
 	dma_addr_t txbuf_phy;
 	int i, rc;
 
-	/* allocate TX buffer, if not already done */
-	if (!tx->bufinfo.start) {
-		tx->bufinfo.size = TX_CNT * WLAN_A4FR_MAXLEN_WEP_FCS;
+	/* allocate TX buffer, if not already done. On pci the
+	 * hostdescs point directly into the mapped skb (see
+	 * acx_tx_map_skb), so no buffer is needed there */
+	if (!IS_PCI(adev) && !tx->bufinfo.start) {
+		tx->bufinfo.size = adev->tx_cnt * WLAN_A4FR_MAXLEN_WEP_FCS;
 		rc = acx_allocate(adev, tx->bufinfo.size, &tx->bufinfo.phy,
 			&tx->bufinfo.start, "txbuf_start");
 		if (rc)
@@ -323,7 +325,7 @@ static int acx_create_tx_host_desc_queue(acx_device_t *adev, struct hw_tx_queue
 
 	/* allocate the TX host descriptor queue pool */
 	if (!tx->hostdescinfo.start) {
-		tx->hostdescinfo.size = TX_CNT * 2 * sizeof(*hostdesc);
+		tx->hostdescinfo.size = adev->tx_cnt * 2 * sizeof(*hostdesc);
 		rc = acx_allocate(adev, tx->hostdescinfo.size, &tx->hostdescinfo.phy,
 			(void**) &tx->hostdescinfo.start, "txhostdesc_start");
 		if (rc)
@@ -355,7 +357,7 @@ static int acx_create_tx_host_desc_queue(acx_device_t *adev, struct hw_tx_queue
  * WG311v2 is even more bogus, doesn't work.  Keeping this code
  * (#ifdef'ed out) for documentational purposes.
  */
-	for (i = 0; i < TX_CNT * 2; i++) {
+	for (i = 0; i < adev->tx_cnt * 2; i++) {
 		hostdesc_phy += sizeof(*hostdesc);
 		if (!(i & 1)) {
 			hostdesc->hd.data_phy = cpu2acx(txbuf_phy);
@@ -389,11 +391,12 @@ static int acx_create_tx_host_desc_queue(acx_device_t *adev, struct hw_tx_queue
 
 	/* We initialize two hostdescs so that they point to adjacent
 	 * memory areas. Thus txbuf is really just a contiguous memory
-	 * area */
-	for (i = 0; i < TX_CNT * 2; i++) {
+	 * area. On pci, data and data_phy are set per frame. */
+	for (i = 0; i < adev->tx_cnt * 2; i++) {
 		hostdesc_phy += sizeof(*hostdesc);
 
-		hostdesc->hd.data_phy = cpu2acx(txbuf_phy);
+		if (!IS_PCI(adev))
+			hostdesc->hd.data_phy = cpu2acx(txbuf_phy);
 		/* done by memset(0): hostdesc->data_offset = 0; */
 		/* hostdesc->reserved = ... */
 		hostdesc->hd.Ctl_16 = cpu_to_le16(DESC_CTL_HOSTOWN);
@@ -402,7 +405,7 @@ static int acx_create_tx_host_desc_queue(acx_device_t *adev, struct hw_tx_queue
 		/* done by memset(0): hostdesc->pNext = ptr2acx(NULL); */
 		/* hostdesc->Status = ... */
 		/* ->data is a non-hardware field: */
-		hostdesc->data = txbuf;
+		hostdesc->data = IS_PCI(adev) ? NULL : txbuf;
 
 		if (!(i & 1)) {
 			txbuf += BUF_LEN_HOSTDESC1;
@@ -466,7 +469,7 @@ static void acx_create_rx_desc_queue(acx_device_t *adev, u32 rx_queue_start)
 
 		rxdesc = adev->hw_rx_queue.acxdescinfo.start;
 
-		for (i = 0; i < RX_CNT; i++) {
+		for (i = 0; i < adev->rx_cnt; i++) {
 			log(L_DEBUG, "rx descriptor %d @ 0x%p\n", i, rxdesc);
 
 			if (IS_PCI(adev))
@@ -484,7 +487,7 @@ static void acx_create_rx_desc_queue(acx_device_t *adev, u32 rx_queue_start)
 		/* rxdesc_start should be right AFTER Tx pool */
 		adev->hw_rx_queue.acxdescinfo.start = (rxacxdesc_t *)
 			((u8 *) adev->hw_tx_queue[0].acxdescinfo.start
-				+ (TX_CNT * sizeof(txacxdesc_t)));
+				+ (adev->tx_cnt * sizeof(txacxdesc_t)));
 
 		/* NB: sizeof(txdesc_t) above is valid because we know
 		 * we are in if (acx100) block. Beware of cut-n-pasting
@@ -492,11 +495,11 @@ static void acx_create_rx_desc_queue(acx_device_t *adev, u32 rx_queue_start)
 
 		if (IS_PCI(adev))
 			memset(adev->hw_rx_queue.acxdescinfo.start, 0,
-				RX_CNT * sizeof(*rxdesc));
+				adev->rx_cnt * sizeof(*rxdesc));
 		else { // IS_MEM
 			mem_offs = (uintptr_t) adev->hw_rx_queue.acxdescinfo.start;
 			while (mem_offs < (uintptr_t) adev->hw_rx_queue.acxdescinfo.start
-				+ (RX_CNT * sizeof(*rxdesc))) {
+				+ (adev->rx_cnt * sizeof(*rxdesc))) {
 				write_slavemem32(adev, mem_offs, 0);
 				mem_offs += 4;
 			}
@@ -504,7 +507,7 @@ static void acx_create_rx_desc_queue(acx_device_t *adev, u32 rx_queue_start)
 		/* loop over whole receive pool */
 		rxdesc = adev->hw_rx_queue.acxdescinfo.start;
 		mem_offs = rx_queue_start;
-		for (i = 0; i < RX_CNT; i++) {
+		for (i = 0; i < adev->rx_cnt; i++) {
 			log(L_DEBUG, "rx descriptor @ 0x%p\n", rxdesc);
 			/* point to next rxdesc */
 			if (IS_PCI(adev)){
@@ -571,7 +574,8 @@ static void acx_create_tx_desc_queue(acx_device_t *adev, u32 tx_queue_start, int
 
 	adev->hw_tx_queue[queue_id].head = 0;
 	adev->hw_tx_queue[queue_id].tail = 0;
-	adev->hw_tx_queue[queue_id].free = TX_CNT;
+	adev->hw_tx_queue[queue_id].free = adev->tx_cnt;
+	adev->hw_tx_queue[queue_id].stopped = 0;
 
 	txdesc = tx->acxdescinfo.start;
 	if (IS_PCI(adev)) {
@@ -583,7 +587,7 @@ static void acx_create_tx_desc_queue(acx_device_t *adev, u32 tx_queue_start, int
 		/* ACX111 has a preinitialized Tx buffer! */
 		/* loop over whole send pool */
 		/* FIXME: do we have to do the hostmemptr stuff here?? */
-		for (i = 0; i < TX_CNT; i++) {
+		for (i = 0; i < adev->tx_cnt; i++) {
 
 			txdesc->Ctl_8 = DESC_CTL_HOSTOWN;
 			/* reserve two (hdr desc and payload desc) */
@@ -600,20 +604,20 @@ static void acx_create_tx_desc_queue(acx_device_t *adev, u32 tx_queue_start, int
 		 * acx100) */
 		if (IS_PCI(adev))
 			memset(tx->acxdescinfo.start, 0,
-				TX_CNT * sizeof(*txdesc));
+				adev->tx_cnt * sizeof(*txdesc));
 		else {
 			/* tx->desc_start refers to device memory,
 			  so we can't write directly to it. */
 			clr = (uintptr_t) tx->acxdescinfo.start;
 			while (clr < (uintptr_t) tx->acxdescinfo.start
-				+ (TX_CNT * sizeof(*txdesc))) {
+				+ (adev->tx_cnt * sizeof(*txdesc))) {
 				write_slavemem32(adev, clr, 0);
 				clr += 4;
 			}
 		}
 
 		/* loop over whole send pool */
-		for (i = 0; i < TX_CNT; i++) {
+		for (i = 0; i < adev->tx_cnt; i++) {
 			log(L_DEBUG, "configure card tx descriptor: 0x%p, "
 				"size: %zu\n", txdesc, tx->acxdescinfo.size);
 
@@ -771,7 +775,7 @@ void acx_log_rxbuffer(const acx_device_t *adev)
 	if (unlikely(!rxhostdesc))
 		return;
 
-	for (i = 0; i < RX_CNT; i++) {
+	for (i = 0; i < adev->rx_cnt; i++) {
 		if ((rxhostdesc->hd.Ctl_16 & cpu_to_le16(DESC_CTL_HOSTOWN))
 		    && (rxhostdesc->hd.Status & cpu_to_le32(DESC_STATUS_FULL)))
 			pr_acx("rx: buf %d full\n", i);
@@ -790,7 +794,7 @@ void acx_log_txbuffer(acx_device_t *adev, int queue_id)
 			return;
 
 	pr_acx("tx[%d]: desc->Ctl8's: ", queue_id);
-	for (i = 0; i < TX_CNT; i++) {
+	for (i = 0; i < adev->tx_cnt; i++) {
 		Ctl_8 = (IS_MEM(adev))
 			? read_slavemem8(adev, (uintptr_t) &(txdesc->Ctl_8))
 			: txdesc->Ctl_8;
@@ -2013,7 +2017,7 @@ static txhostdesc_t *acx_get_txhostdesc(acx_device_t *adev, txacxdesc_t *txdesc,
 		return NULL;
 	}
 	index /= adev->hw_tx_queue[queue_id].acxdescinfo.size;
-	if (unlikely(ACX_DEBUG && (index >= TX_CNT))) {
+	if (unlikely(ACX_DEBUG && (index >= adev->tx_cnt))) {
 		pr_acx("bad txdesc ptr %p\n", txdesc);
 		return NULL;
 	}
@@ -2028,6 +2032,92 @@ void *_acx_get_txbuf(acx_device_t *adev, tx_t *tx_opaque, int q)
 	return acx_get_txhostdesc(adev, (txacxdesc_t *) tx_opaque, q)->data;
 }
 
+static void acx_tx_doorbell(acx_device_t *adev)
+{
+	/* flush writes before we tell the adapter that it's its turn now */
+	mmiowb();
+	write_reg16(adev, IO_ACX_INT_TRIG, INT_TRIG_TXPRC);
+	write_flush(adev);
+
+	adev->tx_stats.doorbells++;
+}
+
+/*
+ * acx_tx_kick
+ *
+ * Ring the tx doorbell once for all frames that were filled into
+ * descriptors since acx_tx_queue_go started a batch. On mem, the
+ * queue indicator is updated once for the batch as well: each update
+ * is several slave memory cycles under the firmware's lock, and only
+ * the last one matters.
+ */
+void acx_tx_kick(acx_device_t *adev)
+{
+	unsigned int n = adev->tx_batch_pending;
+	acxmem_lock_flags;
+
+	adev->tx_batch_pending = 0;
+	if (!n)
+		return;
+
+	acxmem_lock();
+	if (IS_MEM(adev))
+		acxmem_update_queue_indicator(adev, 0);
+	acx_tx_doorbell(adev);
+	acxmem_unlock();
+
+	adev->tx_stats.batches++;
+	adev->tx_stats.batch_frames += n;
+	if (n > adev->tx_stats.batch_max)
+		adev->tx_stats.batch_max = n;
+
+	log(L_BUFT, "tx: kicked batch of %u frames\n", n);
+}
+
+/*
+ * acx_tx_map_skb
+ *
+ * Zero-copy tx on pci: instead of copying the frame into a txbuf,
+ * stream-map the skb data and let hostdesc1 (header) and hostdesc2
+ * (body) point into it. The mapping is released again in
+ * acx_tx_clean_txdesc.
+ *
+ * On failure the txdesc reserved by acxpci_alloc_tx is given back.
+ */
+int acx_tx_map_skb(acx_device_t *adev, tx_t *tx_opaque,
+		struct sk_buff *skb, int queue_id)
+{
+	txacxdesc_t *txdesc = (txacxdesc_t*) tx_opaque;
+	txhostdesc_t *hostdesc1, *hostdesc2;
+	dma_addr_t phy;
+
+	hostdesc1 = acx_get_txhostdesc(adev, txdesc, queue_id);
+	hostdesc2 = hostdesc1 + 1;
+
+	phy = dma_map_single(adev->bus_dev, skb->data, skb->len,
+			DMA_TO_DEVICE);
+	if (unlikely(dma_mapping_error(adev->bus_dev, phy))) {
+		pr_acx("tx: dma mapping of %u bytes failed\n", skb->len);
+
+		/* txdesc is still the last one handed out, so simply
+		 * back up the head pointer */
+		txdesc->Ctl_8 = DESC_CTL_HOSTOWN;
+		adev->hw_tx_queue[queue_id].head = ((u8*) txdesc
+			- (u8*) adev->hw_tx_queue[queue_id].acxdescinfo.start)
+			/ adev->hw_tx_queue[queue_id].acxdescinfo.size;
+		adev->hw_tx_queue[queue_id].free++;
+		return -ENOMEM;
+	}
+
+	hostdesc1->skb_phy = phy;
+	hostdesc1->data = skb->data;
+	hostdesc1->hd.data_phy = cpu2acx(phy);
+	hostdesc2->data = skb->data + BUF_LEN_HOSTDESC1;
+	hostdesc2->hd.data_phy = cpu2acx(phy + BUF_LEN_HOSTDESC1);
+
+	return 0;
+}
+
 /*
  * acxmem_l_tx_data
  *
@@ -2035,13 +2125,13 @@ void *_acx_get_txbuf(acx_device_t *adev, tx_t *tx_opaque, int q)
  * tx).  Can be called from acx_i_start_xmit (data frames from net
  * core).
  *
- * FIXME: in case of fragments, should loop over the number of
- * pre-allocated tx descrs, properly setting up transfer data and
- * CTL_xxx flags according to fragment number.
+ * frag is ACX_TX_FRAG_SINGLE, or the position of the frame in a
+ * fragment train, see acx_tx_data_train.
  */
 #if 1	// pci version merge started
 void _acx_tx_data(acx_device_t *adev, tx_t *tx_opaque, int len,
-		struct ieee80211_tx_info *info, struct sk_buff *skb, int queue_id)
+		struct ieee80211_tx_info *info, struct sk_buff *skb, int queue_id,
+		int frag)
 {
 	/*
 	 * txdesc is the address on the ACX
@@ -2093,38 +2183,37 @@ void _acx_tx_data(acx_device_t *adev, tx_t *tx_opaque, int len,
 	 * set or reset particular flags at the exact moment this is
 	 * needed... */
 
-	/* let chip do RTS/CTS handshaking before sending
-	 * in case packet size exceeds threshold */
-
-	/* if (len > adev->rts_threshold) */
-	if (info->flags & IEEE80211_TX_RC_USE_RTS_CTS)
-		SET_BIT(Ctl2_8, DESC_CTL2_RTS);
-	else
-		CLEAR_BIT(Ctl2_8, DESC_CTL2_RTS);
+	/* Fragment train: only the first descriptor is FIRSTFRAG, all
+	 * but the last one MORE_FRAG */
+	if (frag != ACX_TX_FRAG_SINGLE) {
+		if (frag & ACX_TX_FRAG_FIRST)
+			SET_BIT(Ctl_8, DESC_CTL_FIRSTFRAG);
+		else
+			CLEAR_BIT(Ctl_8, DESC_CTL_FIRSTFRAG);
+		if (frag & ACX_TX_FRAG_MORE)
+			SET_BIT(Ctl2_8, DESC_CTL2_MORE_FRAG);
+	}
+	hostdesc1->train = !!(frag & ACX_TX_FRAG_MORE);
 
 	/* ACX111 */
 	if (IS_ACX111(adev)) {
 
 		/* Build rateset for acx111 */
-		rateset = acx111_tx_build_rateset(adev, txdesc, info);
+		rateset = acx111_tx_build_rateset(adev, txdesc, info, skb);
+
+		/* Short preamble only applies to the CCK rates above
+		 * 1Mbps. PBCC at 5.5/11Mbps is all or nothing, see
+		 * acx_op_bss_info_changed. */
+		if (adev->preamble_cur
+			&& (rateset & (RATE111_2 | RATE111_5 | RATE111_11)))
+			rateset |= RATE111_SHORTPRE;
+		if (adev->pbcc_cur && (rateset & (RATE111_5 | RATE111_11)))
+			rateset |= RATE111_PBCC511;
 
 		/* note that if !txdesc->do_auto, txrate->cur has only
 		 * one nonzero bit */
 		txdesc->u.r2.rate111 = cpu_to_le16(rateset);
 
-		/* WARNING: I was never able to make it work with
-		 * prism54 AP.  It was falling down to 1Mbit where
-		 * shortpre is not applicable, and not working at all
-		 * at "5,11 basic rates only" setting.  I even didn't
-		 * see tx packets in radio packet capture.  Disabled
-		 * for now --vda */
-
-		/*| ((clt->shortpre && clt->cur!=RATE111_1) ? RATE111_SHORTPRE : 0) */
-
-#ifdef TODO_FIGURE_OUT_WHEN_TO_SET_THIS
-		/* should add this to rate111 above as necessary */
-		| (clt->pbcc511 ? RATE111_PBCC511 : 0)
-#endif
 		hostdesc1->hd.length = cpu_to_le16(len);
 	}
 	/* ACX100 */
@@ -2132,6 +2221,9 @@ void _acx_tx_data(acx_device_t *adev, tx_t *tx_opaque, int len,
 
 		/* Get rate for acx100, single rate only for acx100 */
 		rateset = ieee80211_get_tx_rate(adev->hw, info)->hw_value;
+		if (adev->pbcc_cur
+			&& (rateset == RATE100_5 || rateset == RATE100_11))
+			rateset |= RATE100_PBCC511;
 		logf1(L_BUFT, "rateset=%u\n", rateset);
 
 		if (IS_PCI(adev))
@@ -2140,27 +2232,17 @@ void _acx_tx_data(acx_device_t *adev, tx_t *tx_opaque, int len,
 			write_slavemem8(adev, (uintptr_t)&(txdesc->u.r1.rate),
 					(u8) rateset);
 
-#ifdef TODO_FIGURE_OUT_WHEN_TO_SET_THIS
-		if (clt->pbcc511) {
-			if (n == RATE100_5 || n == RATE100_11)
-			n |= RATE100_PBCC511;
-		}
-
-		if (clt->shortpre && (clt->cur != RATE111_1))
-		SET_BIT(Ctl_8, DESC_CTL_SHORT_PREAMBLE); /* set Short Preamble */
-#endif
+		if (adev->preamble_cur && rateset != RATE100_1)
+			SET_BIT(Ctl_8, DESC_CTL_SHORT_PREAMBLE);
+		else
+			CLEAR_BIT(Ctl_8, DESC_CTL_SHORT_PREAMBLE);
 
 		/* set autodma and reclaim and 1st mpdu */
-		SET_BIT(Ctl_8, DESC_CTL_FIRSTFRAG |
+		SET_BIT(Ctl_8,
+			((frag & ACX_TX_FRAG_FIRST) ? DESC_CTL_FIRSTFRAG : 0) |
 			(IS_PCI(adev) ? (DESC_CTL_AUTODMA | DESC_CTL_RECLAIM) : 0)
 			);
 
-#if ACX_FRAGMENTATION
-		/* SET_BIT(Ctl2_8, DESC_CTL2_MORE_FRAG); cannot set it
-		 * unconditionally, needs to be set for all non-last
-		 * fragments */
-#endif
-
 		hostdesc1->hd.length = cpu_to_le16(wlhdr_len);
 
 		if (IS_MEM(adev))
@@ -2172,41 +2254,13 @@ void _acx_tx_data(acx_device_t *adev, tx_t *tx_opaque, int len,
 			 * packet header, and the odd indexed descriptor
 			 * following points to the packet data.
 			 *
-			 * The first step is to find free memory in the ACX
-			 * transmit buffers.  They don't necessarily map one
-			 * to one with the transmit queue entries, so search
-			 * through them starting just after the last one used.
+			 * The memory in the ACX transmit buffers was
+			 * reserved by acxmem_alloc_tx together with the
+			 * descriptor, so it can't run out here.
 			 */
-			addr = acxmem_allocate_acx_txbuf_space(adev, len);
-			if (addr) {
-				acxmem_chaincopy_to_slavemem(adev, addr, hostdesc1->data, len);
-			} else {
-				/*
-				 * Bummer.  We thought we might have enough
-				 * room in the transmit buffers to send this
-				 * packet, but it turns out we don't.
-				 * alloc_tx has already marked this transmit
-				 * descriptor as HOSTOWN and ACXDONE, which
-				 * means the ACX will hang when it gets to
-				 * this descriptor unless we do something
-				 * about it.  Having a bubble in the transmit
-				 * queue just doesn't seem to work, so we have
-				 * to reset this transmit queue entry's state
-				 * to its original value and back up our head
-				 * pointer to point back to this entry.
-				 */
-				 /* OW FIXME Logging */
-				pr_info("Bummer. Not enough room in the txbuf_space.\n");
-				hostdesc1->hd.length = 0;
-				hostdesc2->hd.length = 0;
-				write_slavemem16(adev, (uintptr_t) &(txdesc->total_length), 0);
-				write_slavemem8(adev, (uintptr_t) &(txdesc->Ctl_8), DESC_CTL_HOSTOWN
-						| DESC_CTL_FIRSTFRAG);
-				adev->hw_tx_queue[queue_id].head = ((u8*) txdesc - (u8*) adev->hw_tx_queue[queue_id].acxdescinfo.start)
-						/ adev->hw_tx_queue[queue_id].acxdescinfo.size;
-				adev->hw_tx_queue[queue_id].free++;
-				goto end_of_chain;
-			}
+			addr = hostdesc1->acx_txbuf;
+			hostdesc1->acx_txbuf = 0;
+			acxmem_chaincopy_to_slavemem(adev, addr, hostdesc1->data, len);
 			/*
 			 * Tell the ACX where the packet is.
 			 */
@@ -2214,6 +2268,13 @@ void _acx_tx_data(acx_device_t *adev, tx_t *tx_opaque, int len,
 		}
 	}
 
+	/* let chip do RTS/CTS handshaking before sending, if mac80211,
+	 * the rts_threshold or ERP protection want it */
+	if (acx_tx_use_rts(adev, info, IS_ACX111(adev) ? rateset : 0, skb))
+		SET_BIT(Ctl2_8, DESC_CTL2_RTS);
+	else
+		CLEAR_BIT(Ctl2_8, DESC_CTL2_RTS);
+
 	/* don't need to clean ack/rts statistics here, already
 	 * done on descr cleanup */
 
@@ -2240,16 +2301,19 @@ void _acx_tx_data(acx_device_t *adev, tx_t *tx_opaque, int len,
 	}
 	/* unused: txdesc->tx_time = cpu_to_le32(jiffies); */
 
-	/*
-	 * Update the queue indicator to say there's data on the first queue.
-	 */
-	if (IS_MEM(adev))
-		acxmem_update_queue_indicator(adev, 0);
-
-	/* flush writes before we tell the adapter that it's its turn now */
-	mmiowb();
-	write_reg16(adev, IO_ACX_INT_TRIG, INT_TRIG_TXPRC);
-	write_flush(adev);
+	/* When submitting a batch, the queue indicator is updated and
+	 * the doorbell rung once at the end by acx_tx_kick */
+	if (adev->tx_batching)
+		adev->tx_batch_pending++;
+	else {
+		/*
+		 * Update the queue indicator to say there's data on
+		 * the first queue.
+		 */
+		if (IS_MEM(adev))
+			acxmem_update_queue_indicator(adev, 0);
+		acx_tx_doorbell(adev);
+	}
 
 	hostdesc1->skb = skb;
 
@@ -2258,8 +2322,6 @@ void _acx_tx_data(acx_device_t *adev, tx_t *tx_opaque, int len,
 	 * separate logs for acx100/111 to have human-readable
 	 * rates */
 
-end_of_chain:
-
 	/* Debugging */
 	if (unlikely(acx_debug & (L_XFER|L_DATA))) {
 		u16 fc = ((struct ieee80211_hdr *)
@@ -2294,6 +2356,123 @@ end_of_chain:
 }
 #endif	// acxmem_tx_data()
 
+/*
+ * acx_tx_data_train
+ *
+ * Put the n fragments of one MSDU on the ring as a single train:
+ * reserve all descriptors at once, map all fragments, then hand the
+ * descriptors to the acx starting with the last one, so it never
+ * finds the train incomplete. Only the last fragment gets a tx status,
+ * see acx_tx_clean_txdesc. pci only.
+ *
+ * Returns -EBUSY if the ring has no room for the whole train, and
+ * -ENOMEM if a mapping failed, leaving the fragments to the caller.
+ */
+int acx_tx_data_train(acx_device_t *adev, struct sk_buff **train,
+		unsigned int n, int queue_id)
+{
+	txacxdesc_t *txdesc[ACX_TX_MAX_FRAGS];
+	txhostdesc_t *hostdesc;
+	unsigned int head, i, j;
+	int batching, frag;
+
+	if (!IS_PCI(adev) || n > ACX_TX_MAX_FRAGS)
+		return -ENXIO;
+
+	head = adev->hw_tx_queue[queue_id].head;
+	if (!acxpci_alloc_tx(adev, queue_id, n))
+		return -EBUSY;
+
+	for (i = 0; i < n; i++) {
+		txdesc[i] = acx_get_txacxdesc(adev, (head + i) % adev->tx_cnt,
+					queue_id);
+		if (acx_tx_map_skb(adev, (tx_t *) txdesc[i], train[i], queue_id))
+			goto fail_map;
+	}
+
+	/* One doorbell for the whole train */
+	batching = adev->tx_batching;
+	adev->tx_batching = 1;
+
+	for (i = n; i-- > 0; ) {
+		frag = (i == 0 ? ACX_TX_FRAG_FIRST : 0)
+			| (i < n - 1 ? ACX_TX_FRAG_MORE : 0);
+		_acx_tx_data(adev, (tx_t *) txdesc[i], train[i]->len,
+			IEEE80211_SKB_CB(train[i]), train[i], queue_id, frag);
+	}
+
+	adev->tx_batching = batching;
+	if (!batching)
+		acx_tx_kick(adev);
+
+	return 0;
+
+fail_map:
+	/* acx_tx_map_skb gave back txdesc[i] already */
+	for (j = 0; j < n; j++) {
+		if (j == i)
+			continue;
+		if (j < i) {
+			hostdesc = acx_get_txhostdesc(adev, txdesc[j], queue_id);
+			dma_unmap_single(adev->bus_dev, hostdesc->skb_phy,
+					train[j]->len, DMA_TO_DEVICE);
+		}
+		acx_get_txacxdesc(adev, (head + j) % adev->tx_cnt,
+				queue_id)->Ctl_8 = DESC_CTL_HOSTOWN;
+		adev->hw_tx_queue[queue_id].free++;
+	}
+	adev->hw_tx_queue[queue_id].head = head;
+
+	return -ENOMEM;
+}
+
+/*
+ * acx_tx_status_batch
+ *
+ * Report the frames cleaned by one acx_tx_clean_txdesc pass to
+ * mac80211. Frames that didn't request a tx status only feed rate
+ * control, and are freed here.
+ */
+static void acx_tx_status_batch(acx_device_t *adev, struct sk_buff_head *done)
+{
+	struct sk_buff *skb;
+	struct ieee80211_tx_info *info;
+#if CONFIG_ACX_MAC80211_VERSION >= KERNEL_VERSION(4, 0, 0)
+	struct ieee80211_sta *sta;
+#endif
+
+	if (skb_queue_empty(done))
+		return;
+
+	/* mem cleans with the acx-spinlock held */
+	if (IS_MEM(adev)) {
+		while ((skb = __skb_dequeue(done)))
+			ieee80211_tx_status_irqsafe(adev->hw, skb);
+		return;
+	}
+
+	local_bh_disable();
+	while ((skb = __skb_dequeue(done))) {
+		info = IEEE80211_SKB_CB(skb);
+
+#if CONFIG_ACX_MAC80211_VERSION >= KERNEL_VERSION(4, 0, 0)
+		if (!(info->flags & IEEE80211_TX_CTL_REQ_TX_STATUS)
+			&& adev->vif) {
+			rcu_read_lock();
+			sta = ieee80211_find_sta(adev->vif,
+				((struct ieee80211_hdr *) skb->data)->addr1);
+			ieee80211_tx_status_noskb(adev->hw, sta, info);
+			rcu_read_unlock();
+
+			dev_kfree_skb(skb);
+			continue;
+		}
+#endif
+		ieee80211_tx_status(adev->hw, skb);
+	}
+	local_bh_enable();
+}
+
 /*
  * acxmem_l_clean_txdesc
  *
@@ -2307,17 +2486,22 @@ end_of_chain:
 /* OW TODO Very similar with pci: possible merging. */
 unsigned int acx_tx_clean_txdesc(acx_device_t *adev, int queue_id)
 {
-	txacxdesc_t *txdesc;
+	txacxdesc_t *txdesc, *desc;
 	txhostdesc_t *hostdesc;
 	unsigned finger;
 	int num_cleaned;
 	u16 r111;
 	u8 error, ack_failures, rts_failures, rts_ok, r100, Ctl_8;
 	u32 acxmem;
-	txacxdesc_t tmptxdesc;
+	txacxdesc_t tmptxdesc, memdesc;
+	struct sk_buff *skb;
+	struct sk_buff_head done;
+	unsigned int done_bytes = 0, airtime = 0;
+	u16 bitrate;
 
 	struct ieee80211_tx_info *txstatus;
 
+	__skb_queue_head_init(&done);
 
 
 	if (IS_MEM(adev)) {
@@ -2342,6 +2526,8 @@ unsigned int acx_tx_clean_txdesc(acx_device_t *adev, int queue_id)
 	 * descs.  We will catch up when all intermediate descs will
 	 * be freed also */
 
+	acx_tx_lock(adev);
+
 	finger = adev->hw_tx_queue[queue_id].tail;
 	num_cleaned = 0;
 	while (likely(finger != adev->hw_tx_queue[queue_id].head)) {
@@ -2353,10 +2539,17 @@ unsigned int acx_tx_clean_txdesc(acx_device_t *adev, int queue_id)
 		 * ring.  We may meet it on the next ring pass
 		 * here. */
 
+		/* mem.c: the whole descriptor in one burst, parsed
+		 * from the host copy */
+		if (IS_MEM(adev)) {
+			acxmem_copy_from_slavemem(adev, (u8 *) &memdesc,
+					(uintptr_t) txdesc, sizeof(memdesc));
+			desc = &memdesc;
+		} else
+			desc = txdesc;
+
 		/* stop if not marked as "tx finished" and "host owned" */
-		Ctl_8 = (IS_MEM(adev))
-			? read_slavemem8(adev, (uintptr_t) &(txdesc->Ctl_8))
-			: txdesc->Ctl_8;
+		Ctl_8 = desc->Ctl_8;
 
 		/* OW FIXME Check against pci.c */
 		if ((Ctl_8 & DESC_CTL_ACXDONE_HOSTOWN)
@@ -2372,27 +2565,12 @@ unsigned int acx_tx_clean_txdesc(acx_device_t *adev, int queue_id)
 		}
 
 		/* remember desc values... */
-		if (IS_MEM(adev)) {
-			error = read_slavemem8(adev, (uintptr_t) &(txdesc->error));
-			ack_failures = read_slavemem8(adev,
-					(uintptr_t) &(txdesc->ack_failures));
-			rts_failures = read_slavemem8(adev,
-					(uintptr_t) &(txdesc->rts_failures));
-			rts_ok = read_slavemem8(adev, (uintptr_t) &(txdesc->rts_ok));
-			/* OW FIXME does this also require le16_to_cpu()? */
-			r100 = read_slavemem8(adev,
-					(uintptr_t) &(txdesc->u.r1.rate));
-			r111 = le16_to_cpu(read_slavemem16(adev,
-					(uintptr_t)&(txdesc->u.r2.rate111)));
-		} else {
-			error = txdesc->error;
-			ack_failures = txdesc->ack_failures;
-			rts_failures = txdesc->rts_failures;
-			rts_ok = txdesc->rts_ok;
-			/* OW FIXME does this also require le16_to_cpu()? */
-			r100 = txdesc->u.r1.rate;
-			r111 = le16_to_cpu(txdesc->u.r2.rate111);
-		}
+		error = desc->error;
+		ack_failures = desc->ack_failures;
+		rts_failures = desc->rts_failures;
+		rts_ok = desc->rts_ok;
+		r100 = desc->u.r1.rate;
+		r111 = le16_to_cpu(desc->u.r2.rate111);
 		/* mem.c gated this with ack_failures > 0, unimportant */
 		log(L_BUFT,
 			"acx: tx: cleaned %u: !ACK=%u !RTS=%u RTS=%u"
@@ -2404,24 +2582,44 @@ unsigned int acx_tx_clean_txdesc(acx_device_t *adev, int queue_id)
 		 * we clean the descriptor: we still need valid descr
 		 * data here */
 		hostdesc = acx_get_txhostdesc(adev, txdesc, queue_id);
+		skb = hostdesc->skb;
+		hostdesc->skb = NULL;
+
+		/* Already freed by acx_tx_drain_rings: the ring isn't
+		 * reset on a vlynq start, just give the desc back */
+		if (unlikely(!skb))
+			goto reclaim;
 
-		txstatus = IEEE80211_SKB_CB(hostdesc->skb);
+		txstatus = IEEE80211_SKB_CB(skb);
 
 		if (!(txstatus->flags & IEEE80211_TX_CTL_NO_ACK)
 			&& !(error & 0x30))
 			txstatus->flags |= IEEE80211_TX_STAT_ACK;
 
 		if (IS_ACX111(adev)) {
-			acx111_tx_build_txstatus(adev, txstatus, r111,
-						ack_failures);
+			bitrate = acx111_tx_build_txstatus(adev, txstatus,
+						r111, ack_failures);
 		} else {
 			txstatus->status.rates[0].count = ack_failures + 1;
+			/* 22Mbps is PBCC anyway, its value has the bit set */
+			bitrate = (r100 == RATE100_22)
+				? r100 : (r100 & ~RATE100_PBCC511);
 		}
+		acx_tx_count_status(adev, txstatus, ack_failures,
+				rts_failures, rts_ok);
+		done_bytes += skb->len;
+		if (txstatus->flags & IEEE80211_TX_STAT_ACK)
+			adev->rc.bytes += skb->len;
+		airtime += acx_tx_airtime(bitrate, skb->len, ack_failures + 1);
 
 		/* Free up the transmit data buffers */
+		if (IS_PCI(adev))
+			dma_unmap_single(adev->bus_dev, hostdesc->skb_phy,
+					skb->len, DMA_TO_DEVICE);
+
+reclaim:
 		if (IS_MEM(adev)) {
-			acxmem = read_slavemem32(adev,
-						(uintptr_t) &(txdesc->AcxMemPtr));
+			acxmem = memdesc.AcxMemPtr.v;
 			if (acxmem)
 				acxmem_reclaim_acx_txbuf_space(adev, acxmem);
 
@@ -2447,45 +2645,92 @@ unsigned int acx_tx_clean_txdesc(acx_device_t *adev, int queue_id)
 		adev->hw_tx_queue[queue_id].free++;
 		num_cleaned++;
 
+		if (unlikely(!skb))
+			goto next;
+
 		/* do error checking, rate handling and logging
 		 * AFTER having done the work, it's faster */
 		if (unlikely(error))
 			acxpcimem_handle_tx_error(adev, error,
 					finger, txstatus);
 
-		/* And finally report upstream */
+		/* And finally report upstream, all together after
+		 * the ring walk. Of a fragment train only the last
+		 * one, see acx_tx_data_train */
+		if (hostdesc->train) {
+			hostdesc->train = 0;
+			ieee80211_free_txskb(adev->hw, skb);
+		} else
+			__skb_queue_tail(&done, skb);
 
-		if (IS_MEM(adev))
-			ieee80211_tx_status_irqsafe(adev->hw, hostdesc->skb);
-		else {
-#if CONFIG_ACX_MAC80211_VERSION < KERNEL_VERSION(2, 6, 37)
-			local_bh_disable();
-			ieee80211_tx_status(adev->hw, hostdesc->skb);
-			local_bh_enable();
-#else
-			ieee80211_tx_status_ni(adev->hw, hostdesc->skb);
-#endif
-		}
+next:
 		/* update pointer for descr to be cleaned next */
-		finger = (finger + 1) % TX_CNT;
+		finger = (finger + 1) % adev->tx_cnt;
 	}
 	/* remember last position */
 	adev->hw_tx_queue[queue_id].tail = finger;
 
+	acx_tx_unlock(adev);
+
+	acx_tx_backlog_complete(adev, done_bytes, airtime);
+	acx_tx_status_batch(adev, &done);
+
 
 	return num_cleaned;
 }
 
+/*
+ * acx_tx_drain_rings
+ *
+ * Give up the frames still on the tx rings, when the device is
+ * stopped: on pci they are still streaming-mapped (see
+ * acx_tx_map_skb). The descriptors are reinitialised on the next
+ * start, but on vlynq, which keeps its rings: there
+ * acx_tx_clean_txdesc gives them back without a tx status.
+ */
+void acx_tx_drain_rings(acx_device_t *adev)
+{
+	txhostdesc_t *hostdesc;
+	struct sk_buff *skb;
+	int q, i;
+
+	acx_tx_lock(adev);
+
+	for (q = 0; q < adev->num_hw_tx_queues; q++) {
+		if (!adev->hw_tx_queue[q].hostdescinfo.start)
+			continue;
+
+		for (i = 0; i < adev->tx_cnt; i++) {
+			hostdesc = &adev->hw_tx_queue[q].hostdescinfo.start[i * 2];
+			skb = hostdesc->skb;
+			if (!skb)
+				continue;
+			hostdesc->skb = NULL;
+			hostdesc->train = 0;
+
+			if (IS_PCI(adev))
+				dma_unmap_single(adev->bus_dev,
+					hostdesc->skb_phy, skb->len,
+					DMA_TO_DEVICE);
+			ieee80211_free_txskb(adev->hw, skb);
+		}
+	}
+
+	acx_tx_unlock(adev);
+
+	acx_tx_backlog_reset(adev);
+}
+
 /* clean *all* Tx descriptors, and regardless of their previous state.
  * Used for brute-force reset handling. */
 void acx_clean_txdesc_emergency(acx_device_t *adev)
 {
-	txacxdesc_t *txd;
+	txacxdesc_t *txd, tmptxdesc;
 	int i;
 
 
 
-	for (i = 0; i < TX_CNT; i++) {
+	for (i = 0; i < adev->tx_cnt; i++) {
 		txd = acx_get_txacxdesc(adev, i, 0);
 
 		/* free it */
@@ -2497,12 +2742,16 @@ void acx_clean_txdesc_emergency(acx_device_t *adev)
 			txd->Ctl_8 = DESC_CTL_HOSTOWN;
 			continue;
 		} else {
-			write_slavemem8(adev, (uintptr_t) &(txd->ack_failures), 0);
-			write_slavemem8(adev, (uintptr_t) &(txd->rts_failures), 0);
-			write_slavemem8(adev, (uintptr_t) &(txd->rts_ok), 0);
-			write_slavemem8(adev, (uintptr_t) &(txd->error), 0);
-			write_slavemem8(adev, (uintptr_t) &(txd->Ctl_8),
-					DESC_CTL_HOSTOWN);
+			/* Ctl_8 to rts_ok are adjacent: one burst */
+			memset(&tmptxdesc, 0, sizeof(tmptxdesc));
+			tmptxdesc.Ctl_8 = DESC_CTL_HOSTOWN;
+			acxmem_copy_to_slavemem(adev,
+				(uintptr_t) &(txd->Ctl_8),
+				&tmptxdesc.Ctl_8,
+				offsetof(txacxdesc_t, u)
+				- offsetof(txacxdesc_t, Ctl_8));
+			/* The txbuf pool is reset below */
+			acx_get_txhostdesc(adev, txd, 0)->acx_txbuf = 0;
 		}
 #if 0
 		u32 acxmem;
@@ -2516,11 +2765,14 @@ void acx_clean_txdesc_emergency(acx_device_t *adev)
 #endif
 		write_slavemem32(adev, (uintptr_t) &(txd->AcxMemPtr), 0);
 	}
-	adev->hw_tx_queue[0].free = TX_CNT;
+	adev->hw_tx_queue[0].free = adev->tx_cnt;
 
 	if (IS_MEM(adev))
 		acxmem_init_acx_txbuf2(adev);
 
+	/* The frames on the ring are gone without a tx status */
+	acx_tx_backlog_reset(adev);
+
 
 }
 
@@ -2742,8 +2994,16 @@ void acx_irq_work(struct work_struct *work)
 			for (i=0; i<adev->num_hw_tx_queues; i++)
 				acx_tx_clean_txdesc(adev, i);
 
+			/* Restart the queues of rings back above
+			 * TX_START_QUEUE, and send what was deferred
+			 * for them */
+			if (acx_tx_wake_hw_tx_queues(adev)
+				|| !skb_queue_empty(&adev->tx_queue))
+				ieee80211_queue_work(adev->hw, &adev->tx_work);
+
 			/* Restart queue if stopped and enough tx-descr free */
 			if (acx_is_hw_tx_queue_start_limit(adev) &&
+				!acx_tx_backlog_full(adev) &&
 				acx_queue_stopped(adev->hw))
 			{
 				log(L_BUF,"tx: wake queue\n");
@@ -3115,11 +3375,26 @@ int acx_op_start(struct ieee80211_hw *hw)
 
 	acx_sem_lock(adev);
 
+	acx_tx_lock(adev);
 	clear_bit(ACX_FLAG_HW_UP, &adev->flags);
+	acx_tx_unlock(adev);
 
 	/* With vlynq a full reset doesn't work yet */
-	if (!IS_VLYNQ(adev))
+	if (!IS_VLYNQ(adev)) {
+		/* New ring sizes: the host descriptor pools are
+		 * reallocated by the reset */
+		if (adev->tx_cnt != adev->tx_cnt_next
+			|| adev->rx_cnt != adev->rx_cnt_next) {
+			log(L_INIT, "ring sizes: tx %u->%u, rx %u->%u\n",
+				adev->tx_cnt, adev->tx_cnt_next,
+				adev->rx_cnt, adev->rx_cnt_next);
+			acx_tx_drain_rings(adev);
+			acx_free_desc_queues(adev);
+			adev->tx_cnt = adev->tx_cnt_next;
+			adev->rx_cnt = adev->rx_cnt_next;
+		}
 		acx_full_reset(adev);
+	}
 
 	acxmem_lock();
 	acx_irq_enable(adev);
@@ -3127,6 +3402,7 @@ int acx_op_start(struct ieee80211_hw *hw)
 
 	acx_update_settings(adev);
 
+	acx_tx_backlog_reset(adev);
 	set_bit(ACX_FLAG_HW_UP, &adev->flags);
 
 	acx_wake_queue(adev->hw, NULL);
@@ -3154,7 +3430,11 @@ void acx_stop(acx_device_t *adev)
 
 	acx_stop_queue(adev->hw, "on ifdown");
 
+	/* Under the tx_lock, so no direct tx (see acx_tx_direct) is
+	 * still in flight afterwards */
+	acx_tx_lock(adev);
 	clear_bit(ACX_FLAG_HW_UP, &adev->flags);
+	acx_tx_unlock(adev);
 
 	/* disable all IRQs, release shared IRQ handler */
 	acxmem_lock();			// null in pci
@@ -3168,6 +3448,7 @@ void acx_stop(acx_device_t *adev)
 	acx_sem_lock(adev);
 
 	acx_tx_queue_flush(adev);
+	acx_tx_drain_rings(adev);
 
 	adev->channel = 1;
 }
@@ -3417,7 +3698,7 @@ int acx111pci_ioctl_info(struct ieee80211_hw *hw, struct iw_request_info *info,
 
 	/* loop over complete receive pool */
 	if (rxdesc)
-		for (i = 0; i < RX_CNT; i++) {
+		for (i = 0; i < adev->rx_cnt; i++) {
 			pr_acx("\ndump internal rxdesc %d:\n"
 				"mem pos %p\n"
 				"next 0x%X\n"
@@ -3441,7 +3722,7 @@ int acx111pci_ioctl_info(struct ieee80211_hw *hw, struct iw_request_info *info,
 
 		/* loop over complete receive pool */
 		if (rxhostdesc)
-		for (i = 0; i < RX_CNT; i++) {
+		for (i = 0; i < adev->rx_cnt; i++) {
 			pr_acx("\ndump host rxdesc %d:\n"
 				"mem pos %p\n"
 				"buffer mem pos 0x%X\n"
@@ -3466,7 +3747,7 @@ int acx111pci_ioctl_info(struct ieee80211_hw *hw, struct iw_request_info *info,
 
 		/* loop over complete transmit pool */
 		if (txdesc)
-		for (i = 0; i < TX_CNT; i++) {
+		for (i = 0; i < adev->tx_cnt; i++) {
 			pr_acx("\ndump internal txdesc %d:\n"
 				"size 0x%X\n"
 				"mem pos %p\n"
@@ -3498,7 +3779,7 @@ int acx111pci_ioctl_info(struct ieee80211_hw *hw, struct iw_request_info *info,
 
 		/* loop over complete host send pool */
 		if (txhostdesc)
-		for (i = 0; i < TX_CNT * 2; i++) {
+		for (i = 0; i < adev->tx_cnt * 2; i++) {
 			pr_acx("\ndump host txdesc %d:\n"
 				"mem pos %p\n"
 				"buffer mem pos 0x%X\n"
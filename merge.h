@@ -80,9 +80,15 @@ DECL_OR_STUB ( PCI_OR_MEM,
 
 DECL_OR_STUB ( PCI_OR_MEM,
 	void _acx_tx_data(acx_device_t *adev, tx_t *tx_opaque, int len,
-			struct ieee80211_tx_info *info, struct sk_buff *skb, int queue_id),
+			struct ieee80211_tx_info *info, struct sk_buff *skb, int queue_id,
+			int frag),
 	{ } )
 
+DECL_OR_STUB ( PCI_OR_MEM,
+	int acx_tx_data_train(acx_device_t *adev, struct sk_buff **train,
+		unsigned int n, int queue_id),
+	{ return -ENXIO; } )
+
 DECL_OR_STUB ( PCI_OR_MEM,
 	void acx_irq_work(struct work_struct *work),
 	{ } )
@@ -126,6 +132,10 @@ DECL_OR_STUB ( PCI_OR_MEM,
 	void acx_power_led(acx_device_t * adev, int enable),
 	{ } )
 
+DECL_OR_STUB ( PCI_OR_MEM,
+	void acx_tx_drain_rings(acx_device_t *adev),
+	{ } )
+
 DECL_OR_STUB ( PCI_OR_MEM,
 	void acx_clean_txdesc_emergency(acx_device_t *adev),
 	{ } )
@@ -142,6 +152,15 @@ DECL_OR_STUB ( PCI_OR_MEM,
 	void *_acx_get_txbuf(acx_device_t * adev, tx_t * tx_opaque, int queue_id),
 	{ return (void*) NULL; } )
 
+DECL_OR_STUB ( PCI_OR_MEM,
+	void acx_tx_kick(acx_device_t *adev),
+	{ } )
+
+DECL_OR_STUB ( PCI_OR_MEM,
+	int acx_tx_map_skb(acx_device_t *adev, tx_t *tx_opaque,
+		struct sk_buff *skb, int queue_id),
+	{ return -ENXIO; } )
+
 
 #if (defined CONFIG_ACX_MAC80211_PCI || defined CONFIG_ACX_MAC80211_MEM)
 
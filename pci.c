@@ -405,7 +405,7 @@ int acxpci_dbgfs_diag_output(struct seq_file *file, acx_device_t *adev)
 	seq_printf(file, "** Rx buf **\n");
 	rxhostdesc = adev->hw_rx_queue.hostdescinfo.start;
 	if (rxhostdesc)
-		for (i = 0; i < RX_CNT; i++) {
+		for (i = 0; i < adev->rx_cnt; i++) {
 			rtl = (i == adev->hw_rx_queue.tail) ? " [tail]" : "";
 			if ((rxhostdesc->hd.Ctl_16 & cpu_to_le16(DESC_CTL_HOSTOWN))
 			    && (rxhostdesc->hd.Status & cpu_to_le32(DESC_STATUS_FULL)))
@@ -423,7 +423,7 @@ int acxpci_dbgfs_diag_output(struct seq_file *file, acx_device_t *adev)
 
 		txdesc = adev->hw_tx_queue[queue_id].acxdescinfo.start;
 		if (txdesc)
-			for (i = 0; i < TX_CNT; i++) {
+			for (i = 0; i < adev->tx_cnt; i++) {
 				thd = (i == adev->hw_tx_queue[queue_id].head) ? " [head]" : "";
 				ttl = (i == adev->hw_tx_queue[queue_id].tail) ? " [tail]" : "";
 
@@ -480,53 +480,62 @@ int acxpci_dbgfs_diag_output(struct seq_file *file, acx_device_t *adev)
  * acxpci_alloc_tx
  * Actually returns a txdesc_t* ptr
  *
- * FIXME: in case of fragments, should allocate multiple descrs after
- * figuring out how many we need and whether we still have
- * sufficiently many.
+ * Reserves count consecutive descriptors, e.g. for a fragment train
+ * (see acx_tx_data_train), and returns the first one. Either all of
+ * them are reserved or none.
  */
-tx_t* acxpci_alloc_tx(acx_device_t * adev, int queue_id)
+tx_t* acxpci_alloc_tx(acx_device_t * adev, int queue_id, unsigned int count)
 {
-	struct txacxdesc *txdesc;
-	unsigned head;
+	struct txacxdesc *txdesc, *first;
+	unsigned head, i;
 	u8 ctl8;
 
 
 
-	if (unlikely(!adev->hw_tx_queue[queue_id].free)) {
-		pr_acx("BUG: no free txdesc left\n");
-		txdesc = NULL;
+	if (unlikely(adev->hw_tx_queue[queue_id].free < count)) {
+		if (count == 1)
+			pr_acx("BUG: no free txdesc left\n");
+		first = NULL;
 		goto end;
 	}
 
 	head = adev->hw_tx_queue[queue_id].head;
-	txdesc = acx_get_txacxdesc(adev, head, queue_id);
-	ctl8 = txdesc->Ctl_8;
-
-	/* 2005-10-11: there were several bug reports on this
-	 * happening but now cause seems to be understood & fixed */
-
-	/* TODO OW Check if this is correct */
-	if (unlikely(DESC_CTL_HOSTOWN != (ctl8 & DESC_CTL_ACXDONE_HOSTOWN))) {
-		/* whoops, descr at current index is not free, so
-		 * probably ring buffer already full */
-		pr_acx("BUG: tx_head:%d Ctl8:0x%02X - failed to find "
-		       "free txdesc\n", head, ctl8);
-		txdesc = NULL;
-		goto end;
+	first = acx_get_txacxdesc(adev, head, queue_id);
+
+	for (i = 0; i < count; i++) {
+		txdesc = acx_get_txacxdesc(adev, (head + i) % adev->tx_cnt,
+					queue_id);
+		ctl8 = txdesc->Ctl_8;
+
+		/* 2005-10-11: there were several bug reports on this
+		 * happening but now cause seems to be understood & fixed */
+
+		/* TODO OW Check if this is correct */
+		if (unlikely(DESC_CTL_HOSTOWN != (ctl8 & DESC_CTL_ACXDONE_HOSTOWN))) {
+			/* whoops, descr at current index is not free, so
+			 * probably ring buffer already full */
+			pr_acx("BUG: tx_head:%d Ctl8:0x%02X - failed to find "
+			       "free txdesc\n", (head + i) % adev->tx_cnt, ctl8);
+			first = NULL;
+			goto end;
+		}
 	}
 
 	/* Needed in case txdesc won't be eventually submitted for tx */
-	txdesc->Ctl_8 = DESC_CTL_ACXDONE_HOSTOWN;
+	for (i = 0; i < count; i++)
+		acx_get_txacxdesc(adev, (head + i) % adev->tx_cnt,
+				queue_id)->Ctl_8 = DESC_CTL_ACXDONE_HOSTOWN;
 
-	adev->hw_tx_queue[queue_id].free--;
-	log(L_BUFT, "tx: got desc %u, %u remain\n", head, adev->hw_tx_queue[queue_id].free);
+	adev->hw_tx_queue[queue_id].free -= count;
+	log(L_BUFT, "tx: got desc %u (%u), %u remain\n", head, count,
+		adev->hw_tx_queue[queue_id].free);
 
 	/* returning current descriptor, so advance to next free one */
-	adev->hw_tx_queue[queue_id].head = (head + 1) % TX_CNT;
+	adev->hw_tx_queue[queue_id].head = (head + count) % adev->tx_cnt;
 end:
 
 
-	return (tx_t *) txdesc;
+	return (tx_t *) first;
 }
 
 int acxpci_load_firmware(acx_device_t *adev)
@@ -577,12 +586,12 @@ void acxpci_process_rxdesc(acx_device_t *adev)
 	 * rx_tail and the full descriptor we're supposed to
 	 * handle. */
 	tail = adev->hw_rx_queue.tail;
-	count = RX_CNT;
+	count = adev->rx_cnt;
 	while (1) {
 		hostdesc = &adev->hw_rx_queue.hostdescinfo.start[tail];
 
 		/* advance tail regardless of outcome of the below test */
-		tail = (tail + 1) % RX_CNT;
+		tail = (tail + 1) % adev->rx_cnt;
 
 		if ((hostdesc->hd.Ctl_16 & cpu_to_le16(DESC_CTL_HOSTOWN))
 		        && (hostdesc->hd.Status & cpu_to_le32(DESC_STATUS_FULL)))
@@ -615,7 +624,7 @@ void acxpci_process_rxdesc(acx_device_t *adev)
 		        || !(hostdesc->hd.Status & cpu_to_le32(DESC_STATUS_FULL)))
 			break;
 
-		tail = (tail + 1) % RX_CNT;
+		tail = (tail + 1) % adev->rx_cnt;
 	}
 
 	end:
@@ -661,12 +670,16 @@ more bytes may follow
 
 static const struct ieee80211_ops acxpci_hw_ops = {
 	.tx		= acx_op_tx,
+#if ACX_TXQ
+	.wake_tx_queue	= acx_op_wake_tx_queue,
+#endif
 	.conf_tx	= acx_conf_tx,
 	.start		= acx_op_start,
 	.stop		= acx_op_stop,
 	.config		= acx_op_config,
 	.set_key	= acx_op_set_key,
 	.get_stats	= acx_op_get_stats,
+	.set_rts_threshold	= acx_op_set_rts_threshold,
 
 	.add_interface		= acx_op_add_interface,
 	.remove_interface	= acx_op_remove_interface,
@@ -862,7 +875,7 @@ int acx111pci_ioctl_info(struct net_device *ndev,
 
 	/* loop over complete receive pool */
 	if (rxdesc)
-		for (i = 0; i < RX_CNT; i++) {
+		for (i = 0; i < adev->rx_cnt; i++) {
 			pr_acx("\ndump internal rxdesc %d:\n"
 			       "mem pos %p\n"
 			       "next 0x%X\n"
@@ -886,7 +899,7 @@ int acx111pci_ioctl_info(struct net_device *ndev,
 
 	/* loop over complete receive pool */
 	if (rxhostdesc)
-		for (i = 0; i < RX_CNT; i++) {
+		for (i = 0; i < adev->rx_cnt; i++) {
 			pr_acx("\ndump host rxdesc %d:\n"
 			       "mem pos %p\n"
 			       "buffer mem pos 0x%X\n"
@@ -911,7 +924,7 @@ int acx111pci_ioctl_info(struct net_device *ndev,
 
 	/* loop over complete transmit pool */
 	if (txdesc)
-		for (i = 0; i < TX_CNT; i++) {
+		for (i = 0; i < adev->tx_cnt; i++) {
 			pr_acx("\ndump internal txdesc %d:\n"
 			       "size 0x%X\n"
 			       "mem pos %p\n"
@@ -942,7 +955,7 @@ int acx111pci_ioctl_info(struct net_device *ndev,
 
 	/* loop over complete host send pool */
 	if (txhostdesc)
-		for (i = 0; i < TX_CNT * 2; i++) {
+		for (i = 0; i < adev->tx_cnt * 2; i++) {
 			pr_acx("\ndump host txdesc %d:\n"
 			       "mem pos %p\n"
 			       "buffer mem pos 0x%X\n"
@@ -1092,6 +1105,12 @@ static int acxpci_probe(struct pci_dev *pdev,
 	/* Specify DMA mask 30-bit. Problem was triggered from
 	 * >=2.6.33 on x86_64 */
 	adev->bus_dev->coherent_dma_mask = DMA_BIT_MASK(30);
+	/* Same for the streaming mappings of the zero-copy tx path */
+	if (dma_set_mask(adev->bus_dev, DMA_BIT_MASK(30))) {
+		pr_acx("no usable 30-bit dma mask\n");
+		result = -EIO;
+		goto fail_pci_set_dma_mask;
+	}
 
 	/* chiptype is u8 but id->driver_data is ulong Works for now
 	 * (possible values are 1 and 2) */
@@ -1267,6 +1286,8 @@ static int acxpci_probe(struct pci_dev *pdev,
 
 	fail_unknown_chiptype:
 
+	fail_pci_set_dma_mask:
+
 	/* pci_enable_device(pdev) */
 	fail_pci_enable_device:
 	pci_disable_device(pdev);
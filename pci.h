@@ -9,7 +9,7 @@ int acxpci_validate_fw(acx_device_t *adev, const firmware_image_t *fw_image,
                        u32 offset);
 void acxpci_init_mboxes(acx_device_t *adev);
 
-tx_t *acxpci_alloc_tx(acx_device_t *adev, int q);
+tx_t *acxpci_alloc_tx(acx_device_t *adev, int q, unsigned int count);
 
 int acxpci_dbgfs_diag_output(struct seq_file *file, acx_device_t *adev);
 
@@ -23,6 +23,7 @@
 #include "mem.h"
 #include "merge.h"
 #include "usb.h"
+#include "init.h"
 #include "utils.h"
 #include "rx.h"
 
@@ -104,19 +105,27 @@ const char* acx_get_packet_type_string(u16 fc)
 }
 
 
+/* Data frames in a page longer than this are not copied, but
+ * attached to the skb, see acx_rx */
+#define ACX_RX_COPYBREAK	256
+
 /*
  * acx_l_rx
  *
  * The end of the Rx path. Pulls data from a rxhostdesc into a socket
  * buffer and feeds it to the network stack via netif_rx().
+ *
+ * If rxbuf lies in page (usb), only the 802.11 header and the
+ * LLC/SNAP header of longer data frames are copied, the payload is
+ * added as a page fragment. mac80211 pulls what it needs.
  */
-static void acx_rx(acx_device_t *adev, rxbuffer_t *rxbuf)
+static void acx_rx(acx_device_t *adev, rxbuffer_t *rxbuf, struct page *page)
 {
 	struct ieee80211_rx_status *status;
 
 	struct ieee80211_hdr *w_hdr;
 	struct sk_buff *skb;
-	int buflen;
+	int buflen, copylen;
 	int level;
 
 	if (unlikely(!test_bit(ACX_FLAG_HW_UP, &adev->flags))) {
@@ -127,15 +136,31 @@ static void acx_rx(acx_device_t *adev, rxbuffer_t *rxbuf)
 	w_hdr = acx_get_wlan_hdr(adev, rxbuf);
 	buflen = RXBUF_BYTES_RCVD(adev, rxbuf);
 
+	copylen = buflen;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 4, 0)
+	if (page && buflen > ACX_RX_COPYBREAK
+		&& ieee80211_is_data(w_hdr->frame_control))
+		copylen = ieee80211_hdrlen(w_hdr->frame_control) + 8;
+#endif
+
 	/* Allocate our skb */
-	skb = dev_alloc_skb(buflen);
+	skb = dev_alloc_skb(copylen);
 	if (!skb) {
 		pr_info("skb allocation FAILED\n");
 		return;
 	}
 
-	skb_put(skb, buflen);
-	memcpy(skb->data, w_hdr, buflen);
+	skb_put(skb, copylen);
+	memcpy(skb->data, w_hdr, copylen);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 4, 0)
+	if (copylen < buflen) {
+		get_page(page);
+		skb_add_rx_frag(skb, 0, page,
+			(u8 *) w_hdr + copylen - (u8 *) page_address(page),
+			buflen - copylen, USB_RXBUF_SIZE);
+	}
+#endif
 
 	status = IEEE80211_SKB_RXCB(skb);
 	memset(status, 0, sizeof(*status));
@@ -158,17 +183,15 @@ static void acx_rx(acx_device_t *adev, rxbuffer_t *rxbuf)
 
 	status->antenna = 1;
 
-	/* TODO I'm not sure whether this is (currently) really required. In tests
-	 * this didn't made a difference. Maybe compare what other drivers do.
-	 * TODO Verify translation to rate_idx.
-	 */
-#if 0
-	if (rxbuf->phy_stat_baseband & (1 << 3)) /* Uses OFDM */
-		status->rate_idx =
-			acx_plcp_get_bitrate_ofdm(rxbuf->phy_plcp_signal);
-	else
-		status->rate_idx =
-			acx_plcp_get_bitrate_cck(rxbuf->phy_plcp_signal);
+	status->rate_idx = adev->rates.rx_index[RXBUF_RATE_KEY(rxbuf)];
+	/* Short preamble: CCK above 1Mbps without the long preamble bit */
+	if (!(rxbuf->phy_stat_baseband &
+			(RXBUF_BB_LONG_PREAMBLE | RXBUF_BB_OFDM))
+		&& status->rate_idx)
+#if CONFIG_ACX_MAC80211_VERSION >= KERNEL_VERSION(4, 12, 0)
+		status->enc_flags |= RX_ENC_FLAG_SHORTPRE;
+#else
+		status->flag |= RX_FLAG_SHORTPRE;
 #endif
 
 	if (IS_PCI(adev)) {
@@ -188,6 +211,7 @@ static void acx_rx(acx_device_t *adev, rxbuffer_t *rxbuf)
 
 	adev->stats.rx_packets++;
 	adev->stats.rx_bytes += skb->len;
+	acx_mem_pool_count(adev, skb->len);
 
 }
 
@@ -197,6 +221,18 @@ static void acx_rx(acx_device_t *adev, rxbuffer_t *rxbuf)
  * NB: used by USB code also
  */
 void acx_process_rxbuf(acx_device_t *adev, rxbuffer_t *rxbuf)
+{
+	acx_process_rxbuf_page(adev, rxbuf, NULL);
+}
+
+/*
+ * acx_process_rxbuf_page
+ *
+ * Same, for an rxbuf lying in page: the frame payload may be handed
+ * on as a page fragment, see acx_rx
+ */
+void acx_process_rxbuf_page(acx_device_t *adev, rxbuffer_t *rxbuf,
+			struct page *page)
 {
 	struct ieee80211_hdr *hdr;
 	u16 fc, buf_len;
@@ -232,7 +268,7 @@ void acx_process_rxbuf(acx_device_t *adev, rxbuffer_t *rxbuf)
 		acx_dump_bytes(hdr, buf_len);
 	}
 
-	acx_rx(adev, rxbuf);
+	acx_rx(adev, rxbuf, page);
 
 	/* Now check Rx quality level, AFTER processing packet.  I
 	 * tried to figure out how to map these levels to dBm values,
@@ -248,62 +284,3 @@ void acx_process_rxbuf(acx_device_t *adev, rxbuffer_t *rxbuf)
 
 
 }
-
-/* TODO Verify these functions: translation rxbuffer.phy_plcp_signal to rate_idx */
-#if 0
-
-/** Rate values **/
-#define ACX_CCK_RATE_1MB            0
-#define ACX_CCK_RATE_2MB            1
-#define ACX_CCK_RATE_5MB            2
-#define ACX_CCK_RATE_11MB           3
-#define ACX_OFDM_RATE_6MB           4
-#define ACX_OFDM_RATE_9MB           5
-#define ACX_OFDM_RATE_12MB          6
-#define ACX_OFDM_RATE_18MB          7
-#define ACX_OFDM_RATE_24MB          8
-#define ACX_OFDM_RATE_36MB          9
-#define ACX_OFDM_RATE_48MB          10
-#define ACX_OFDM_RATE_54MB          11
-
-static u8 acx_plcp_get_bitrate_cck(u8 plcp)
-{
-        switch (plcp) {
-        case 0x0A:
-                return ACX_CCK_RATE_1MB;
-        case 0x14:
-                return ACX_CCK_RATE_2MB;
-        case 0x37:
-                return ACX_CCK_RATE_5MB;
-        case 0x6E:
-                return ACX_CCK_RATE_11MB;
-        }
-        return 0;
-}
-
-/* Extract the bitrate out of an OFDM PLCP header. */
-static u8 acx_plcp_get_bitrate_ofdm(u8 plcp)
-{
-        switch (plcp & 0xF) {
-        case 0xB:
-                return ACX_OFDM_RATE_6MB;
-        case 0xF:
-                return ACX_OFDM_RATE_9MB;
-        case 0xA:
-                return ACX_OFDM_RATE_12MB;
-        case 0xE:
-                return ACX_OFDM_RATE_18MB;
-        case 0x9:
-                return ACX_OFDM_RATE_24MB;
-        case 0xD:
-                return ACX_OFDM_RATE_36MB;
-        case 0x8:
-                return ACX_OFDM_RATE_48MB;
-        case 0xC:
-                return ACX_OFDM_RATE_54MB;
-        }
-        return 0;
-}
-#endif
-
-
@@ -23,23 +23,326 @@
 #include "mem.h"
 #include "merge.h"
 #include "usb.h"
+#include "init.h"
 #include "main.h"
 #include "tx.h"
 
-static int acx_is_hw_tx_queue_stop_limit(acx_device_t *adev)
+/*
+ * Per-ring flow control
+ *
+ * Each hw_tx_queue is stopped when its free descs drop below
+ * TX_STOP_QUEUE, and woken again at TX_START_QUEUE. Stopping a ring
+ * only stops the mac80211 queues feeding it: with tx_ac_queues the
+ * access category ring feeds one mac80211 queue, while the shared
+ * NOENC_QUEUE_ID ring feeds all of them.
+ */
+static int acx_hw_tx_queue_feeds(acx_device_t *adev, int queue_id, int q)
+{
+	return !adev->tx_ac_queues || queue_id == NOENC_QUEUE_ID
+		|| queue_id == ACX111_AC_QUEUE_ID(q);
+}
+
+static int acx_mac80211_queue_blocked(acx_device_t *adev, int q)
 {
 	int i;
-	for (i=0; i<adev->num_hw_tx_queues; i++)
-	{
-		if (adev->hw_tx_queue[i].free < TX_STOP_QUEUE)
-		{
-			logf1(L_BUF, "Tx_free < TX_STOP_QUEUE (queue_id=%d: %u tx desc left):"
-				" Stop queue.\n", i, adev->hw_tx_queue[i].free);
+
+	for (i = 0; i < adev->num_hw_tx_queues; i++)
+		if (adev->hw_tx_queue[i].stopped
+			&& acx_hw_tx_queue_feeds(adev, i, q))
 			return 1;
+
+	return 0;
+}
+
+static void acx_tx_stop_hw_tx_queues(acx_device_t *adev)
+{
+	struct hw_tx_queue *txq;
+	int i, q;
+
+	/* usb wakes all queues on its own from the tx status, based on
+	 * hw_tx_queue[0] */
+	if (IS_USB(adev)) {
+		if (adev->hw_tx_queue[0].free < TX_STOP_QUEUE)
+			acx_stop_queue(adev->hw, NULL);
+		return;
+	}
+
+	for (i = 0; i < adev->num_hw_tx_queues; i++) {
+		txq = &adev->hw_tx_queue[i];
+
+		if (txq->stopped || txq->free >= TX_STOP_QUEUE)
+			continue;
+
+		logf1(L_BUF, "Tx_free < TX_STOP_QUEUE (queue_id=%d: %u tx desc left):"
+			" Stop queue.\n", i, txq->free);
+
+		txq->stopped = 1;
+		txq->stop_count++;
+
+		for (q = 0; q < adev->hw->queues; q++)
+			if (acx_hw_tx_queue_feeds(adev, i, q))
+				ieee80211_stop_queue(adev->hw, q);
+	}
+}
+
+/*
+ * acx_tx_wake_hw_tx_queues
+ *
+ * Called after cleaning the tx rings. Returns the number of rings
+ * that were restarted.
+ */
+int acx_tx_wake_hw_tx_queues(acx_device_t *adev)
+{
+	struct hw_tx_queue *txq;
+	int i, q, woken = 0;
+
+	acx_tx_lock(adev);
+
+	for (i = 0; i < adev->num_hw_tx_queues; i++) {
+		txq = &adev->hw_tx_queue[i];
+
+		if (!txq->stopped || txq->free < TX_START_QUEUE)
+			continue;
+
+		log(L_BUF, "tx: wake queue_id=%d (%u tx desc free)\n",
+			i, txq->free);
+
+		txq->stopped = 0;
+		txq->wake_count++;
+		woken++;
+	}
+
+	if (woken && !acx_tx_backlog_full(adev))
+		for (q = 0; q < adev->hw->queues; q++)
+			if (!acx_mac80211_queue_blocked(adev, q))
+				ieee80211_wake_queue(adev->hw, q);
+
+	acx_tx_unlock(adev);
+
+	return woken;
+}
+
+/*
+ * Tx backlog limit
+ *
+ * Bounds the bytes accepted by acx_op_tx and not yet reported back
+ * (waiting in adev->tx_queue or on the rings), BQL-style. The limit is
+ * kept as an airtime budget, converted to bytes with the effective
+ * rate of the completed frames: a fixed number of frames is either
+ * far too much latency at 1Mbps, or too little to keep the rings busy
+ * with small frames.
+ *
+ * The budget grows when the backlog drains completely after having
+ * stopped the mac80211 queues (woken too late, the hw starved), and
+ * shrinks by the unused part of the limit (slack) when it wasn't hit
+ * for ACX_TX_BACKLOG_SLACK_HOLD.
+ */
+static void acx_tx_backlog_update_limit(acx_device_t *adev)
+{
+	typeof(adev->tx_backlog) *bl = &adev->tx_backlog;
+
+	/* usecs * 100kbps / 80 = bytes */
+	bl->limit = max_t(unsigned int, ACX_TX_BACKLOG_MIN_BYTES,
+			bl->limit_us * bl->rate / 80);
+}
+
+void acx_tx_backlog_init(acx_device_t *adev)
+{
+	typeof(adev->tx_backlog) *bl = &adev->tx_backlog;
+
+	spin_lock_init(&bl->lock);
+	bl->bytes = 0;
+	bl->limit_us = ACX_TX_BACKLOG_INIT_US;
+	/* Start from 11Mbps, corrected by the first completions */
+	bl->rate = 110;
+	bl->min_slack = UINT_MAX;
+	bl->slack_start = jiffies;
+	bl->stopped = 0;
+	bl->held = 0;
+	acx_tx_backlog_update_limit(adev);
+}
+
+/*
+ * acx_tx_backlog_wake
+ *
+ * The backlog went below the limit after holding back the mac80211
+ * queues: wake those not blocked by a full ring (the ring cleaning
+ * wakes them later). Called under the backlog lock, so it can't race
+ * with acx_tx_backlog_add stopping them.
+ */
+static void acx_tx_backlog_wake(acx_device_t *adev)
+{
+	typeof(adev->tx_backlog) *bl = &adev->tx_backlog;
+	int q;
+
+	if (!bl->held || bl->bytes >= bl->limit)
+		return;
+	bl->held = 0;
+
+	/* Stopped devices are woken by their start */
+	if (!test_bit(ACX_FLAG_HW_UP, &adev->flags))
+		return;
+
+	log(L_BUFT, "tx: backlog %u < limit %u: wake queue\n",
+		bl->bytes, bl->limit);
+
+	if (IS_USB(adev)) {
+		if (adev->hw_tx_queue[0].free >= TX_START_QUEUE)
+			acx_wake_queue(adev->hw, NULL);
+	} else {
+		for (q = 0; q < adev->hw->queues; q++)
+			if (!acx_mac80211_queue_blocked(adev, q))
+				ieee80211_wake_queue(adev->hw, q);
+	}
+	ieee80211_queue_work(adev->hw, &adev->tx_work);
+}
+
+/*
+ * acx_tx_backlog_reset
+ *
+ * Recount the backlog from adev->tx_queue, after the rings were
+ * cleaned without reporting their frames.
+ */
+void acx_tx_backlog_reset(acx_device_t *adev)
+{
+	typeof(adev->tx_backlog) *bl = &adev->tx_backlog;
+	struct sk_buff *skb;
+	unsigned long flags, qflags;
+
+	spin_lock_irqsave(&bl->lock, flags);
+
+	bl->bytes = 0;
+	spin_lock_irqsave(&adev->tx_queue.lock, qflags);
+	skb_queue_walk(&adev->tx_queue, skb)
+		bl->bytes += skb->len;
+	spin_unlock_irqrestore(&adev->tx_queue.lock, qflags);
+
+	bl->stopped = 0;
+	acx_tx_backlog_wake(adev);
+
+	spin_unlock_irqrestore(&bl->lock, flags);
+}
+
+int acx_tx_backlog_full(acx_device_t *adev)
+{
+	return adev->tx_backlog.bytes >= adev->tx_backlog.limit;
+}
+
+/*
+ * acx_tx_backlog_add
+ *
+ * Account a frame entering acx_op_tx, before it can be completed.
+ * Stops the mac80211 queues once the limit is reached. This is done
+ * under the backlog lock, so a completion updating the backlog
+ * afterwards always sees the queues stopped and can wake them.
+ */
+void acx_tx_backlog_add(acx_device_t *adev, unsigned int len)
+{
+	typeof(adev->tx_backlog) *bl = &adev->tx_backlog;
+	unsigned long flags;
+
+	spin_lock_irqsave(&bl->lock, flags);
+
+	bl->bytes += len;
+	if (bl->bytes >= bl->limit) {
+		if (!bl->stopped)
+			bl->stop_count++;
+		bl->stopped = 1;
+		bl->held = 1;
+		log(L_BUFT, "tx: backlog %u >= limit %u: stop queue\n",
+			bl->bytes, bl->limit);
+		acx_stop_queue(adev->hw, NULL);
+	}
+
+	spin_unlock_irqrestore(&bl->lock, flags);
+}
+
+/*
+ * acx_tx_backlog_complete
+ *
+ * Account frames leaving the backlog: len bytes, which took airtime
+ * usecs on air (0 if they were dropped without being sent). Wakes the
+ * mac80211 queues if the backlog held them back, also when the frames
+ * were dropped and no tx status will follow. Waking for the rings is
+ * left to the ring completion paths.
+ */
+void acx_tx_backlog_complete(acx_device_t *adev, unsigned int len,
+			unsigned int airtime)
+{
+	typeof(adev->tx_backlog) *bl = &adev->tx_backlog;
+	unsigned int rate, slack;
+	unsigned long flags;
+
+	if (!len)
+		return;
+
+	spin_lock_irqsave(&bl->lock, flags);
+
+	bl->bytes -= min(len, bl->bytes);
+
+	/* Effective rate of these frames, retries and overhead
+	 * included: ewma with weight 1/4 */
+	if (airtime) {
+		rate = max_t(unsigned int, 1, len * 80 / airtime);
+		bl->rate = (3 * bl->rate + rate) / 4;
+	}
+
+	if (!bl->bytes && bl->stopped) {
+		/* Drained while the queues were held back */
+		bl->starve_count++;
+		bl->limit_us = min(bl->limit_us + bl->limit_us / 4,
+				(unsigned int) ACX_TX_BACKLOG_MAX_US);
+		bl->stopped = 0;
+		bl->min_slack = UINT_MAX;
+		bl->slack_start = jiffies;
+	} else {
+		slack = (bl->limit > bl->bytes) ? bl->limit - bl->bytes : 0;
+		bl->min_slack = min(bl->min_slack, slack);
+
+		if (time_after(jiffies,
+				bl->slack_start + ACX_TX_BACKLOG_SLACK_HOLD)) {
+			/* Give back half of the airtime never used */
+			if (!bl->stopped && bl->min_slack != UINT_MAX) {
+				slack = bl->min_slack * 80 / bl->rate / 2;
+				bl->limit_us = max_t(unsigned int,
+					ACX_TX_BACKLOG_MIN_US,
+					bl->limit_us - min(slack, bl->limit_us));
+			}
+			bl->stopped = 0;
+			bl->min_slack = UINT_MAX;
+			bl->slack_start = jiffies;
 		}
 	}
 
-	return 0;
+	acx_tx_backlog_update_limit(adev);
+	acx_tx_backlog_wake(adev);
+
+	spin_unlock_irqrestore(&bl->lock, flags);
+}
+
+/*
+ * acx_tx_airtime
+ *
+ * Estimated usecs on air for a frame of len bytes sent tries times at
+ * bitrate (100kbps units, as in struct ieee80211_rate).
+ */
+unsigned int acx_tx_airtime(u16 bitrate, unsigned int len,
+			unsigned int tries)
+{
+	unsigned int overhead;
+
+	if (!bitrate || bitrate == (u16) -1)
+		return 0;
+
+	switch (bitrate) {
+	case 10: case 20: case 55: case 110: case 220: case 330:
+		overhead = ACX_TX_DSSS_OVERHEAD_US;
+		break;
+	default:
+		overhead = ACX_TX_OFDM_OVERHEAD_US;
+	}
+
+	return (len * 80 / bitrate + overhead) * tries;
 }
 
 static void acx_dealloc_tx(acx_device_t *adev, tx_t *tx_opaque)
@@ -68,11 +371,13 @@ static void acx_tx_data(acx_device_t *adev, tx_t *tx_opaque, int len,
 	struct ieee80211_tx_info *ieeectl, struct sk_buff *skb, int q)
 {
 	if (IS_PCI(adev))
-		return _acx_tx_data(adev, tx_opaque, len, ieeectl, skb, q);
+		return _acx_tx_data(adev, tx_opaque, len, ieeectl, skb, q,
+				ACX_TX_FRAG_SINGLE);
 	if (IS_USB(adev))
 		return acxusb_tx_data(adev, tx_opaque, len, ieeectl, skb);
 	if (IS_MEM(adev))
-		return _acx_tx_data(adev, tx_opaque, len, ieeectl, skb, q);
+		return _acx_tx_data(adev, tx_opaque, len, ieeectl, skb, q,
+				ACX_TX_FRAG_SINGLE);
 
 	log(L_ANY, "Unsupported dev_type=%i\n", (adev)->dev_type);
 
@@ -86,7 +391,7 @@ static void acx_tx_data(acx_device_t *adev, tx_t *tx_opaque, int len,
 static tx_t* acx_alloc_tx(acx_device_t *adev, unsigned int len, int q)
 {
 	if (IS_PCI(adev))
-		return acxpci_alloc_tx(adev, q);
+		return acxpci_alloc_tx(adev, q, 1);
 	if (IS_USB(adev))
 		return acxusb_alloc_tx(adev);
 	if (IS_MEM(adev))
@@ -96,30 +401,55 @@ static tx_t* acx_alloc_tx(acx_device_t *adev, unsigned int len, int q)
 	return (NULL);
 }
 
-static int acx_tx_frame(acx_device_t *adev, struct sk_buff *skb)
+/*
+ * acx_tx_queue_id
+ *
+ * Select the hw tx queue for a frame. With tx_ac_queues, each
+ * mac80211 access category has its own ring, see ACX111_AC_QUEUE_ID.
+ */
+static int acx_tx_queue_id(acx_device_t *adev, struct sk_buff *skb)
 {
-	tx_t *tx;
-	void *txbuf;
-	struct ieee80211_tx_info *ctl;
-	struct ieee80211_hdr *hdr;
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr*) skb->data;
+	int protected = hdr->frame_control & IEEE80211_FCTL_PROTECTED;
 
 	/* Default queue_id for data-frames */
 	int queue_id=1;
 
-	ctl = IEEE80211_SKB_CB(skb);
-	hdr = (struct ieee80211_hdr*) skb->data;
+	if (adev->tx_ac_queues)
+		queue_id = ACX111_AC_QUEUE_ID(skb_get_queue_mapping(skb));
 
-	/* Sent unencrypted frames (e.g. mgmt- and eapol-frames) on NOENC_QUEUE_ID */
-	if (!(hdr->frame_control & IEEE80211_FCTL_PROTECTED))
-		queue_id=NOENC_QUEUE_ID;
+	if (protected && adev->hw_encrypt_enabled) {
+		__set_bit(queue_id, &adev->tx_queue_crypt_used);
+		return queue_id;
+	}
 
-	/* With hw-encyption disabled, sent all on the NOENC queue.
-	 * This is required, if the was previously used using hw-encyption:
-	 * once a queue was used, if will not stop encryption, and so the
-	 * current solution is to avoid the encrypting queues entirely. */
-	if (!adev->hw_encrypt_enabled)
+	/* Sent unencrypted frames (e.g. mgmt- and eapol-frames) on
+	 * NOENC_QUEUE_ID, and also all frames with hw-encyption
+	 * disabled. This is required, if the queue was previously
+	 * used with hw-encyption: once a queue was used, it will not
+	 * stop encryption. Queues never used for encryption can stay
+	 * on their access category. */
+	if (!adev->tx_ac_queues
+		|| test_bit(queue_id, &adev->tx_queue_crypt_used))
 		queue_id=NOENC_QUEUE_ID;
 
+	return queue_id;
+}
+
+static int acx_tx_frame_one(acx_device_t *adev, struct sk_buff *skb,
+			int queue_id)
+{
+	tx_t *tx;
+	void *txbuf;
+	struct ieee80211_tx_info *ctl;
+
+	ctl = IEEE80211_SKB_CB(skb);
+
+	/* Keep a few free descs between head and tail of tx ring. It
+	 * is not absolutely needed, just feels safer */
+	if (adev->hw_tx_queue[queue_id].stopped)
+		return (-EBUSY);
+
 	tx = acx_alloc_tx(adev, skb->len, queue_id);
 
 	if (unlikely(!tx)) {
@@ -127,6 +457,13 @@ static int acx_tx_frame(acx_device_t *adev, struct sk_buff *skb)
 		return (-EBUSY);
 	}
 
+	/* Zero-copy on pci: the hostdescs point directly into the skb */
+	if (IS_PCI(adev)) {
+		if (acx_tx_map_skb(adev, tx, skb, queue_id))
+			return (-ENOMEM);
+		goto tx_data;
+	}
+
 	txbuf = acx_get_txbuf(adev, tx, queue_id);
 
 	if (unlikely(!txbuf)) {
@@ -144,29 +481,148 @@ static int acx_tx_frame(acx_device_t *adev, struct sk_buff *skb)
 	 */
 	memcpy(txbuf, skb->data, skb->len);
 
+tx_data:
 	acx_tx_data(adev, tx, skb->len, ctl, skb, queue_id);
 
 	adev->stats.tx_packets++;
 	adev->stats.tx_bytes += skb->len;
+	acx_mem_pool_count(adev, skb->len);
+
+	acx_tx_stop_hw_tx_queues(adev);
 
 	return 0;
 }
 
+static int acx_tx_is_fragment(struct sk_buff *skb)
+{
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr*) skb->data;
+
+	return ieee80211_has_morefrags(hdr->frame_control)
+		|| (hdr->seq_ctrl & cpu_to_le16(IEEE80211_SCTL_FRAG));
+}
+
+/*
+ * acx_tx_fragment
+ *
+ * mac80211 hands over the fragments of an MSDU one by one. Hold them
+ * back on adev->tx_frags until the last one arrives, and then put all
+ * of them on the ring as one train, so the acx sends them in a single
+ * burst. A train longer than the ring can take at once goes out
+ * fragment by fragment instead. An MSDU of more than ACX_TX_MAX_FRAGS
+ * fragments is dropped as a whole, returning -EMSGSIZE.
+ */
+static int acx_tx_fragment(acx_device_t *adev, struct sk_buff *skb,
+			int queue_id)
+{
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr*) skb->data;
+	struct sk_buff_head *frags =
+		&adev->tx_frags[skb_get_queue_mapping(skb) % IEEE80211_NUM_ACS];
+	struct sk_buff *train[ACX_TX_MAX_FRAGS];
+	struct sk_buff *frag;
+	unsigned int n, i;
+	int ret;
+
+	if (ieee80211_has_morefrags(hdr->frame_control)) {
+		if (skb_queue_len(frags) >= ACX_TX_MAX_FRAGS - 1) {
+			/* Can't become a whole train anymore: drop all of
+			 * it, this one by the caller */
+			while ((frag = __skb_dequeue(frags))) {
+				acx_tx_backlog_complete(adev, frag->len, 0);
+				ieee80211_free_txskb(adev->hw, frag);
+			}
+			return -EMSGSIZE;
+		}
+		__skb_queue_tail(frags, skb);
+		return 0;
+	}
+
+	n = skb_queue_len(frags) + 1;
+
+	if (n > adev->tx_cnt - TX_STOP_QUEUE) {
+		while ((frag = skb_peek(frags))) {
+			ret = acx_tx_frame_one(adev, frag, queue_id);
+			if (ret == -EBUSY)
+				return ret;
+			__skb_unlink(frag, frags);
+			if (ret < 0) {
+				acx_tx_backlog_complete(adev, frag->len, 0);
+				ieee80211_free_txskb(adev->hw, frag);
+			}
+		}
+		return acx_tx_frame_one(adev, skb, queue_id);
+	}
+
+	i = 0;
+	skb_queue_walk(frags, frag)
+		train[i++] = frag;
+	train[i] = skb;
+
+	ret = acx_tx_data_train(adev, train, n, queue_id);
+	if (ret == -EBUSY)
+		return ret;
+
+	/* Sent or dropped (the last one by the caller), all together */
+	__skb_queue_head_init(frags);
+	for (i = 0; i < n - 1; i++) {
+		if (ret < 0) {
+			acx_tx_backlog_complete(adev, train[i]->len, 0);
+			ieee80211_free_txskb(adev->hw, train[i]);
+		} else {
+			adev->stats.tx_packets++;
+			adev->stats.tx_bytes += train[i]->len;
+			acx_mem_pool_count(adev, train[i]->len);
+		}
+	}
+	if (ret < 0)
+		return ret;
+
+	adev->stats.tx_packets++;
+	adev->stats.tx_bytes += skb->len;
+	acx_mem_pool_count(adev, skb->len);
+
+	acx_tx_stop_hw_tx_queues(adev);
+
+	return 0;
+}
+
+static int acx_tx_frame(acx_device_t *adev, struct sk_buff *skb)
+{
+	int queue_id = acx_tx_queue_id(adev, skb);
+
+	/* Fragment trains are put on the ring as a whole, pci only */
+	if (IS_PCI(adev) && acx_tx_is_fragment(skb))
+		return acx_tx_fragment(adev, skb, queue_id);
+
+	return acx_tx_frame_one(adev, skb, queue_id);
+}
+
 void acx_tx_queue_flush(acx_device_t *adev)
 {
 	struct sk_buff *skb;
 	struct ieee80211_tx_info *info;
+	int i;
 
 	while ((skb = skb_dequeue(&adev->tx_queue))) {
 		info = IEEE80211_SKB_CB(skb);
 
 		logf1(L_BUF, "Flushing skb 0x%p", skb);
+		acx_tx_backlog_complete(adev, skb->len, 0);
 
 		if (!(info->flags & IEEE80211_TX_CTL_REQ_TX_STATUS))
 			continue;
 
 		ieee80211_tx_status(adev->hw, skb);
 	}
+
+	/* Incomplete fragment trains */
+	acx_tx_lock(adev);
+	for (i = 0; i < IEEE80211_NUM_ACS; i++) {
+		while ((skb = __skb_dequeue(&adev->tx_frags[i]))) {
+			acx_tx_backlog_complete(adev, skb->len, 0);
+			dev_kfree_skb(skb);
+		}
+	}
+	acx_tx_unlock(adev);
 }
 
 void acx_stop_queue(struct ieee80211_hw *hw, const char *msg)
@@ -204,101 +660,329 @@ static u8 acx_rate111to100(u16 r)
 */
 
 
-int acx_rate111_hwvalue_to_rateindex(u16 hw_value)
+/*
+ * Rate statistics and driver rate control
+ *
+ * The tx status of every frame is folded into adev->rc, per rate, in
+ * both rate control modes: debugfs rate_stats shows it next to the
+ * goodput, also for a fixed rate as baseline. With the driver rate
+ * control (acx_rate_control=1), acx_rc_update picks the rateset for
+ * unicast data like minstrel does: the best and second best expected
+ * throughput, and the most reliable rate, which the firmware walks
+ * down from the highest one (see ACX1xx_IE_RATE_FALLBACK).
+ *
+ * The statistics are kept per device, not per station: the driver rate
+ * control is refused in all modes but station (acx_op_add_interface),
+ * where the AP is the only unicast peer. Its choice is limited to the
+ * rates the AP supports, rc.supp, see acx_op_bss_info_changed.
+ */
+void acx_rc_reset(acx_device_t *adev)
+{
+	memset(adev->rc.rate, 0, sizeof(adev->rc.rate));
+
+	/* Start optimistic, the sampling sorts it out */
+	adev->rc.max_tp = __fls(adev->rc.supp);
+	adev->rc.max_tp2 = __ffs(adev->rc.supp);
+	adev->rc.max_prob = __ffs(adev->rc.supp);
+	adev->rc.sample_idx = 0;
+	adev->rc.sample_cnt = 0;
+	adev->rc.next_update = jiffies + ACX_RC_INTERVAL;
+	adev->rc.bytes = 0;
+	adev->rc.start = jiffies;
+}
+
+static void acx_rc_update(acx_device_t *adev)
 {
-	int i, r=-1;
+	struct acx_rc_rate *r;
+	unsigned int prob, airtime, tp = 0, tp2 = 0;
+	u8 retries;
+	int i, best, best2, reliable;
+
+	best = best2 = reliable = __ffs(adev->rc.supp);
+
+	for (i = 0; i < adev->rates.count; i++) {
+		r = &adev->rc.rate[i];
+
+		if (r->attempts) {
+			prob = r->success * 1000 / r->attempts;
+			/* The first sample is taken as is */
+			r->prob = (r->attempts_total == r->attempts) ? prob
+				: (r->prob * ACX_RC_EWMA_LEVEL
+				   + prob * (100 - ACX_RC_EWMA_LEVEL)) / 100;
+			r->attempts = 0;
+			r->success = 0;
+		}
 
-	for (i = 0; i < acx111_rates_sizeof; i++) {
-		if (acx111_rates[i].hw_value == hw_value) {
-			r = i;
-			break;
+		if (!(adev->rc.supp & BIT(i)))
+			continue;
+
+		/* Expected throughput for a 1200 byte frame, rates
+		 * below 10% success don't count */
+		airtime = acx_tx_airtime(adev->rates.bitrate[i], 1200, 1);
+		r->tp = (r->prob < 100 || !airtime) ? 0
+			: r->prob * (1200 * 80 / airtime) / 1000;
+
+		if (r->tp > tp) {
+			tp2 = tp;
+			best2 = best;
+			tp = r->tp;
+			best = i;
+		} else if (r->tp > tp2) {
+			tp2 = r->tp;
+			best2 = i;
 		}
+
+		if (r->prob > adev->rc.rate[reliable].prob
+			|| (r->prob >= 950
+				&& r->tp > adev->rc.rate[reliable].tp))
+			reliable = i;
+	}
+
+	adev->rc.max_tp = best;
+	adev->rc.max_tp2 = best2;
+	adev->rc.max_prob = reliable;
+	adev->rc.next_update = jiffies + ACX_RC_INTERVAL;
+
+	if (!adev->rc.driver)
+		return;
+
+	/* Stay longer on a rate that delivers, fall back fast to the
+	 * reliable one otherwise */
+	retries = (adev->rc.rate[best].prob >= 900) ? 2 : 1;
+	if (retries != adev->rate_fallback_retries) {
+		adev->rate_fallback_retries = retries;
+		acx_schedule_task(adev, ACX_AFTER_IRQ_UPDATE_RATE_FALLBACK);
 	}
-	return (r);
 }
 
-u16 acx_rate111_hwvalue_to_bitrate(u16 hw_value)
+/*
+ * acx_rc_rateset
+ *
+ * Rateset of a unicast data frame chosen by the driver: a fixed rate,
+ * or the rate control's choice. The rates go to info->control.rates
+ * too, in the order the firmware will try them, for the tx status.
+ */
+static u16 acx_rc_rateset(acx_device_t *adev, struct ieee80211_tx_info *info)
 {
-	int i;
-	u16 bitrate = -1;
+	u16 rateset;
+	int i, k, sample = -1;
+
+	if (adev->rc.fixed >= 0) {
+		rateset = adev->rates.hw_value[adev->rc.fixed];
+	} else {
+		rateset = adev->rates.hw_value[adev->rc.max_tp]
+			| adev->rates.hw_value[adev->rc.max_tp2]
+			| adev->rates.hw_value[adev->rc.max_prob];
+
+		if (++adev->rc.sample_cnt >= ACX_RC_SAMPLE_EVERY) {
+			adev->rc.sample_cnt = 0;
+			do {
+				adev->rc.sample_idx = (adev->rc.sample_idx + 1)
+					% adev->rates.count;
+			} while (!(adev->rc.supp & BIT(adev->rc.sample_idx)));
+			sample = adev->rc.sample_idx;
+			rateset = adev->rates.hw_value[sample]
+				| adev->rates.hw_value[adev->rc.max_prob];
+		}
+	}
 
-	i = acx_rate111_hwvalue_to_rateindex(hw_value);
-	if (i != -1)
-		bitrate = acx111_rates[i].bitrate;
+	k = 0;
+	for (i = adev->rates.count - 1; i >= 0 && k < IEEE80211_TX_MAX_RATES; i--) {
+		if (!(rateset & adev->rates.hw_value[i]))
+			continue;
+		info->control.rates[k].idx = i;
+		info->control.rates[k].count = adev->rate_fallback_retries + 1;
+		info->control.rates[k].flags = 0;
+		k++;
+	}
+	if (k < IEEE80211_TX_MAX_RATES)
+		info->control.rates[k].idx = -1;
 
-	return (bitrate);
+	return rateset;
 }
 
+/* Out of line: the rates debug output stays off the tx path */
+static noinline void acx111_tx_log_rateset(acx_device_t *adev,
+			struct ieee80211_tx_info *info, u16 rateset)
+{
+	char tmpstr[256];
+	int i, idx, n;
 
+	n = sprintf(tmpstr, "rates in info [bitrate,hw_value,count]: ");
+	for (i = 0; i < IEEE80211_TX_MAX_RATES; i++) {
+		idx = info->control.rates[i].idx;
+		if (idx < 0 || idx >= adev->rates.count)
+			break;
+		n += sprintf(tmpstr + n, "%i=[%i,0x%04X,%i]%s",
+			i, adev->rates.bitrate[idx], adev->rates.hw_value[idx],
+			info->control.rates[i].count,
+			(i < IEEE80211_TX_MAX_RATES - 1) ? ", " : "");
+	}
+	logf1(L_ANY, "%s: rateset=0x%04X\n", tmpstr, rateset);
+}
 
 u16 acx111_tx_build_rateset(acx_device_t *adev, txacxdesc_t *txdesc,
-			struct ieee80211_tx_info *info)
+			struct ieee80211_tx_info *info, struct sk_buff *skb)
 {
-	int i;
-
-	char tmpstr[256];
-	struct ieee80211_rate *tmpbitrate;
-	int tmpcount;
-
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *) skb->data;
+	int i, idx;
 	u16 rateset = 0;
 
-	int debug = acx_debug & L_BUFT;
-
-	if (debug)
-		sprintf(tmpstr, "rates in info [bitrate,hw_value,count]: ");
+	if ((adev->rc.driver || adev->rc.fixed >= 0)
+		&& ieee80211_is_data(hdr->frame_control)
+		&& !(info->flags & IEEE80211_TX_CTL_NO_ACK)) {
+		rateset = acx_rc_rateset(adev, info);
+		goto out;
+	}
 
 	for (i = 0; i < IEEE80211_TX_MAX_RATES; i++) {
-		if (info->control.rates[i].idx < 0)
+		idx = info->control.rates[i].idx;
+		if (idx < 0 || unlikely(idx >= adev->rates.count))
 			break;
+		rateset |= adev->rates.hw_value[idx];
+	}
 
-		tmpbitrate = &adev->hw->wiphy->bands[info->band]
-			->bitrates[info->control.rates[i].idx];
-		tmpcount = info->control.rates[i].count;
-
-		rateset |= tmpbitrate->hw_value;
+	/* Driver rate control: mac80211 left the other frames to us,
+	 * send them at the lowest basic rate */
+	if (!rateset)
+		rateset = adev->rate_basic & -adev->rate_basic;
 
-		if (debug)
-			sprintf(tmpstr + strlen(tmpstr), "%i=[%i,0x%04X,%i]%s",
-				i, tmpbitrate->bitrate, tmpbitrate->hw_value,
-				tmpcount,
-				(i < IEEE80211_TX_MAX_RATES - 1)
-				? ", " : "");
-	}
-	if (debug)
-		logf1(L_ANY, "%s: rateset=0x%04X\n", tmpstr, rateset);
+out:
+	if (unlikely(acx_debug & L_BUFT))
+		acx111_tx_log_rateset(adev, info, rateset);
 
 	return (rateset);
 }
 
-void acx111_tx_build_txstatus(acx_device_t *adev,
-			struct ieee80211_tx_info *txstatus, u16 r111,
-			u8 ack_failures)
+/*
+ * acx_tx_use_rts
+ *
+ * Whether the frame needs the RTS/CTS handshake (DESC_CTL2_RTS):
+ * mac80211 asks for RTS or CTS protection in the first rate's flags.
+ * The descriptor has no CTS-to-self, so CTS protection falls back to
+ * RTS/CTS. Driver rate control leaves the flags clear, so apply the
+ * rts_threshold to the frame, and protect the OFDM rates of the acx111
+ * rateset (rate111, 0 on acx100) while the BSS asks for it. Never for
+ * frames that get no ACK.
+ */
+int acx_tx_use_rts(acx_device_t *adev, struct ieee80211_tx_info *info,
+		u16 rate111, struct sk_buff *skb)
 {
-	u16 rate_hwvalue;
-	u16 rate_bitrate;
-	int rate_index;
-	int j;
+	struct ieee80211_hdr *hdr = (struct ieee80211_hdr *) skb->data;
+
+	if ((info->flags & IEEE80211_TX_CTL_NO_ACK)
+		|| is_multicast_ether_addr(hdr->addr1))
+		return 0;
 
-	rate_hwvalue = 1 << highest_bit(r111 & RATE111_ALL);
-	rate_index = acx_rate111_hwvalue_to_rateindex(rate_hwvalue);
+	if (info->control.rates[0].flags
+		& (IEEE80211_TX_RC_USE_RTS_CTS | IEEE80211_TX_RC_USE_CTS_PROTECT))
+		return 1;
+
+	if (adev->rc.driver && skb->len > adev->rts_threshold)
+		return 1;
+
+	return adev->rc.driver && adev->cts_prot
+		&& (rate111 & RATE111_ALL & ~RATE111_ACX100_COMPAT);
+}
+
+/*
+ * acx_tx_count_status
+ *
+ * Retry and RTS counters from a tx status, for get_stats and the
+ * debugfs tx_stats.
+ */
+void acx_tx_count_status(acx_device_t *adev, struct ieee80211_tx_info *info,
+		u8 ack_failures, u8 rts_failures, u8 rts_ok)
+{
+	if (ack_failures)
+		adev->tx_stats.retried++;
+	if (!(info->flags & (IEEE80211_TX_STAT_ACK | IEEE80211_TX_CTL_NO_ACK)))
+		adev->tx_stats.failed++;
+
+	adev->ieee_stats.dot11ACKFailureCount += ack_failures;
+	adev->ieee_stats.dot11RTSFailureCount += rts_failures;
+	adev->ieee_stats.dot11RTSSuccessCount += rts_ok;
+}
 
+/*
+ * acx111_tx_build_txstatus
+ *
+ * Rebuild the multi-rate-retry status from the rateset the frame was
+ * submitted with: the firmware tries each rate, from the highest one
+ * down, rate_fallback_retries times before falling back, and reports
+ * the rate it ended at in r111. Returns that bitrate (100kbps units),
+ * or (u16) -1 if unknown.
+ */
+u16 acx111_tx_build_txstatus(acx_device_t *adev,
+			struct ieee80211_tx_info *txstatus, u16 r111,
+			u8 ack_failures)
+{
+	struct ieee80211_tx_rate orig[IEEE80211_TX_MAX_RATES];
+	unsigned int tries = ack_failures + 1, n;
+	int acked = !!(txstatus->flags & IEEE80211_TX_STAT_ACK);
+	int rate_index, idx, final, b, j, k;
+	u16 set = 0;
+
+	r111 &= RATE111_ALL;
+	if (unlikely(!r111))
+		return (u16) -1;
+
+	final = highest_bit(r111);
+	rate_index = adev->rates.index[final];
+	if (unlikely(rate_index < 0))
+		return (u16) -1;
+
+	memcpy(orig, txstatus->status.rates, sizeof(orig));
 	for (j = 0; j < IEEE80211_TX_MAX_RATES; j++) {
-		if (txstatus->status.rates[j].idx == rate_index) {
-			txstatus->status.rates[j].count = ack_failures + 1;
+		if (orig[j].idx < 0 || orig[j].idx >= adev->rates.count)
 			break;
-		}
+		set |= adev->rates.hw_value[orig[j].idx];
 	}
+	set |= 1 << final;
 
-	if ((acx_debug & L_BUFT) && (ack_failures > 0)) {
+	k = 0;
+	for (b = highest_bit(set); b >= final; b--) {
+		idx = adev->rates.index[b];
+		if (!(set & (1 << b)) || idx < 0)
+			continue;
 
-		rate_bitrate = acx_rate111_hwvalue_to_bitrate(rate_hwvalue);
-		logf1(L_ANY,
-			"sentrate(bitrate,hw_value)=(%d,0x%04X)"
-			" status.rates[%d].count=%d\n",
-			rate_bitrate, rate_hwvalue, j,
-			(j < IEEE80211_TX_MAX_RATES)
-			? txstatus->status.rates[j].count : -1);
+		n = (b == final) ? tries
+			: min_t(unsigned int, adev->rate_fallback_retries,
+				tries - 1);
+		if (!n || k >= IEEE80211_TX_MAX_RATES)
+			continue;
+		tries -= n;
+
+		txstatus->status.rates[k].idx = idx;
+		txstatus->status.rates[k].count = n;
+		txstatus->status.rates[k].flags = 0;
+		for (j = 0; j < IEEE80211_TX_MAX_RATES; j++)
+			if (orig[j].idx == idx) {
+				txstatus->status.rates[k].flags = orig[j].flags;
+				break;
+			}
+		k++;
+
+		adev->rc.rate[idx].attempts += n;
+		adev->rc.rate[idx].attempts_total += n;
+		if (b == final && acked) {
+			adev->rc.rate[idx].success++;
+			adev->rc.rate[idx].success_total++;
+		}
 	}
+	if (k < IEEE80211_TX_MAX_RATES)
+		txstatus->status.rates[k].idx = -1;
+
+	if (time_after(jiffies, adev->rc.next_update))
+		acx_rc_update(adev);
+
+	if (unlikely(acx_debug & L_BUFT) && (ack_failures > 0))
+		logf1(L_ANY, "sentrate(bitrate,hw_value)=(%d,0x%04X)"
+			" ack_failures=%u rates=%d\n",
+			adev->rates.bitrate[rate_index], 1 << final,
+			ack_failures, k);
+
+	return adev->rates.bitrate[rate_index];
 }
 
 void acxpcimem_handle_tx_error(acx_device_t *adev, u8 error,
@@ -486,38 +1170,199 @@ void acx_tx_work(struct work_struct *work)
 }
 
 
+/*
+ * acx_tx_direct
+ *
+ * Fast path for acx_op_tx: put the frame directly into a free tx
+ * descriptor, instead of bouncing it through the tx_work. Only done
+ * on PCI, where filling a descriptor doesn't require the sem. Returns
+ * 0 if the frame was submitted, and <0 if the caller has to defer it
+ * to the tx_work.
+ */
+int acx_tx_direct(acx_device_t *adev, struct sk_buff *skb)
+{
+	int ret;
+
+	if (!IS_PCI(adev))
+		return -EOPNOTSUPP;
+
+	acx_tx_lock(adev);
+
+	if (unlikely(!test_bit(ACX_FLAG_HW_UP, &adev->flags))) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	/* Don't overtake frames already waiting for the tx_work */
+	if (!skb_queue_empty(&adev->tx_queue)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	ret = acx_tx_frame(adev, skb);
+
+out:
+	acx_tx_unlock(adev);
+	return ret;
+}
+
+#if ACX_TXQ
+/*
+ * acx_op_wake_tx_queue
+ *
+ * mac80211 has frames on one of its intermediate tx queues. They are
+ * pulled by acx_tx_queue_go only as descriptors become free, so the
+ * queueing is done by mac80211 (fq_codel, airtime fairness between
+ * stations), and not in adev->tx_queue.
+ */
+void acx_op_wake_tx_queue(struct ieee80211_hw *hw, struct ieee80211_txq *txq)
+{
+	acx_device_t *adev = hw2adev(hw);
+
+	if (!work_pending(&adev->tx_work))
+		ieee80211_queue_work(hw, &adev->tx_work);
+}
+
+/* Frames for mac80211 queue q can be put on the rings: the same
+ * conditions as for the rings and the backlog to keep q woken */
+static int acx_tx_txq_ready(acx_device_t *adev, int q)
+{
+	if (acx_tx_backlog_full(adev))
+		return 0;
+
+	if (IS_USB(adev))
+		return adev->hw_tx_queue[0].free >= TX_STOP_QUEUE;
+
+	return !acx_mac80211_queue_blocked(adev, q);
+}
+
+/*
+ * acx_tx_pull_txqs
+ *
+ * Dequeue frames from the mac80211 tx queues, in the order given by
+ * its scheduler, as long as the rings take them. Called from
+ * acx_tx_queue_go. Returns <0 on errors other than full rings.
+ */
+static int acx_tx_pull_txqs(acx_device_t *adev)
+{
+	struct ieee80211_hw *hw = adev->hw;
+	struct ieee80211_txq *txq;
+	struct sk_buff *skb;
+	int ac, q, ret = 0;
+
+	for (ac = 0; ac < IEEE80211_NUM_ACS && ret != -ENODEV; ac++) {
+		q = (hw->queues > 1) ? ac : 0;
+
+		ieee80211_txq_schedule_start(hw, ac);
+
+		while (acx_tx_txq_ready(adev, q)
+			&& (txq = ieee80211_next_txq(hw, ac))) {
+
+			while (acx_tx_txq_ready(adev, q)
+				&& (skb = ieee80211_tx_dequeue(hw, txq))) {
+
+				acx_tx_backlog_add(adev, skb->len);
+				ret = acx_tx_frame(adev, skb);
+
+				if (ret == -EBUSY) {
+					/* Out of tx buffers after all:
+					 * can't go back to the txq */
+					skb_queue_tail(&adev->tx_queue, skb);
+					break;
+				} else if (ret < 0) {
+					acx_tx_backlog_complete(adev,
+							skb->len, 0);
+					dev_kfree_skb(skb);
+					if (ret != -ENOMEM
+						&& ret != -EMSGSIZE) {
+						ret = -ENODEV;
+						break;
+					}
+				}
+			}
+
+			/* Rescheduled by mac80211 if it still has frames */
+			acx_return_txq(hw, txq);
+
+			if (ret == -EBUSY || ret == -ENODEV)
+				break;
+		}
+
+		ieee80211_txq_schedule_end(hw, ac);
+	}
+
+	return ret;
+}
+#endif
+
 void acx_tx_queue_go(acx_device_t *adev)
 {
 	struct sk_buff *skb;
+	struct sk_buff_head deferred;
 	int ret;
 
+	__skb_queue_head_init(&deferred);
+
+	acx_tx_lock(adev);
+
+	/* Fill as many descriptors as possible, and ring the doorbell
+	 * only once for the whole batch (saves a MMIO write and read-back
+	 * flush per frame) */
+	adev->tx_batching = 1;
+
 	while ((skb = skb_dequeue(&adev->tx_queue))) {
 
 		ret = acx_tx_frame(adev, skb);
 
-		if (ret == -EBUSY) {
+		if (ret == -EBUSY && adev->tx_ac_queues) {
+			/* Only this skb's ring is full: keep it back,
+			 * but go on with the frames for the others */
+			logf0(L_BUFT, "EBUSY: Deferring skb.\n");
+			__skb_queue_tail(&deferred, skb);
+			continue;
+		} else if (ret == -EBUSY) {
 			logf0(L_BUFT, "EBUSY: Stop queue. Requeuing skb.\n");
 			acx_stop_queue(adev->hw, NULL);
 			skb_queue_head(&adev->tx_queue, skb);
 			goto out;
+		} else if (ret == -ENOMEM) {
+			logf0(L_BUF, "ENOMEM: Dma mapping failed. Dealloc skb.\n");
+			acx_tx_backlog_complete(adev, skb->len, 0);
+			dev_kfree_skb(skb);
+			continue;
+		} else if (ret == -EMSGSIZE) {
+			logf0(L_BUF, "EMSGSIZE: Fragment train too long."
+				" Dealloc skb.\n");
+			acx_tx_backlog_complete(adev, skb->len, 0);
+			dev_kfree_skb(skb);
+			continue;
 		} else if (ret < 0) {
 			logf0(L_BUF, "Other ERR: (Card was removed ?!):"
 				" Stop queue. Dealloc skb.\n");
 			acx_stop_queue(adev->hw, NULL);
+			acx_tx_backlog_complete(adev, skb->len, 0);
 			dev_kfree_skb(skb);
 			goto out;
 		}
+	}
 
-		/* Keep a few free descs between head and tail of tx
-		 * ring. It is not absolutely needed, just feels
-		 * safer */
-		if (acx_is_hw_tx_queue_stop_limit(adev))
-		{
-			acx_stop_queue(adev->hw, NULL);
-			goto out;
-		}
+#if ACX_TXQ
+	/* Only then the frames mac80211 is still holding back */
+	if (acx_tx_pull_txqs(adev) == -ENODEV) {
+		logf0(L_BUF, "Other ERR: (Card was removed ?!):"
+			" Stop queue.\n");
+		acx_stop_queue(adev->hw, NULL);
 	}
+#endif
 out:
+	/* Put the deferred frames back in front, in their order */
+	while ((skb = __skb_dequeue_tail(&deferred)))
+		skb_queue_head(&adev->tx_queue, skb);
+
+	adev->tx_batching = 0;
+	acx_tx_kick(adev);
+
+	acx_tx_unlock(adev);
 	return;
 }
 
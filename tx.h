@@ -4,20 +4,37 @@
 void acx_tx_queue_flush(acx_device_t *adev);
 void acx_stop_queue(struct ieee80211_hw *hw, const char *msg);
 int acx_queue_stopped(struct ieee80211_hw *ieee);
+int acx_tx_wake_hw_tx_queues(acx_device_t *adev);
 void acx_wake_queue(struct ieee80211_hw *hw, const char *msg);
 
-int acx_rate111_hwvalue_to_rateindex(u16 hw_value);
-u16 acx_rate111_hwvalue_to_bitrate(u16 hw_value);
+void acx_rc_reset(acx_device_t *adev);
 u16 acx111_tx_build_rateset(acx_device_t *adev, txacxdesc_t *txdesc,
-			struct ieee80211_tx_info *info);
+			struct ieee80211_tx_info *info, struct sk_buff *skb);
+int acx_tx_use_rts(acx_device_t *adev, struct ieee80211_tx_info *info,
+		u16 rate111, struct sk_buff *skb);
+void acx_tx_count_status(acx_device_t *adev, struct ieee80211_tx_info *info,
+		u8 ack_failures, u8 rts_failures, u8 rts_ok);
 
-void acx111_tx_build_txstatus(acx_device_t *adev,
+u16 acx111_tx_build_txstatus(acx_device_t *adev,
 			struct ieee80211_tx_info *txstatus, u16 r111,
 			u8 ack_failures);
 void acxpcimem_handle_tx_error(acx_device_t *adev, u8 error,
 			unsigned int finger,
 			struct ieee80211_tx_info *info);
 
+void acx_tx_backlog_init(acx_device_t *adev);
+void acx_tx_backlog_reset(acx_device_t *adev);
+int acx_tx_backlog_full(acx_device_t *adev);
+void acx_tx_backlog_add(acx_device_t *adev, unsigned int len);
+void acx_tx_backlog_complete(acx_device_t *adev, unsigned int len,
+			unsigned int airtime);
+unsigned int acx_tx_airtime(u16 bitrate, unsigned int len,
+			unsigned int tries);
+
+int acx_tx_direct(acx_device_t *adev, struct sk_buff *skb);
+#if ACX_TXQ
+void acx_op_wake_tx_queue(struct ieee80211_hw *hw, struct ieee80211_txq *txq);
+#endif
 void acx_tx_work(struct work_struct *work);
 void acx_tx_queue_go(acx_device_t *adev);
 
@@ -130,9 +130,15 @@ MODULE_DEVICE_TABLE(usb, acxusb_ids);
 /* Buffer size for fw upload, same for both ACX100 USB and TNETW1450 */
 #define USB_RWMEM_MAXLEN	2048
 
-/* The number of bulk URBs to use */
+/* The number of bulk URBs to use, rx: default, see usb_rx_urbs */
 #define ACX_TX_URB_CNT		8
-#define ACX_RX_URB_CNT		2
+#define ACX_RX_URB_CNT		4
+#define ACX_RX_URB_MIN		2
+#define ACX_RX_URB_MAX		16
+
+static unsigned int acx_usb_rx_urbs = ACX_RX_URB_CNT;
+module_param_named(usb_rx_urbs, acx_usb_rx_urbs, uint, 0444);
+MODULE_PARM_DESC(usb_rx_urbs, "Bulk-in transfers kept in flight (usb)");
 
 /* Should be sent to the bulkout endpoint */
 #define ACX_USB_REQ_UPLOAD_FW	0x10
@@ -144,9 +150,11 @@ MODULE_DEVICE_TABLE(usb, acxusb_ids);
  * Now, this is just plain lying, but the device insists in giving us
  * huge packets. We supply extra space after rxbuffer. Need to understand
  * it better...
+ *
+ * One bulk-in transfer fills one page (4k).
  */
-#define RXBUFSIZE (sizeof(rxbuffer_t) + \
-		   (sizeof(usb_rx_t) - sizeof(struct usb_rx_plain)))
+#define RXBUFSIZE USB_RXBUF_SIZE
+#define RXBUF_ORDER get_order(RXBUFSIZE)
 
 
 /*
@@ -816,62 +824,27 @@ static void dump_device_descriptor(struct usb_device_descriptor *dd)
  */
 
 /*
- * acxusb_i_complete_rx()
- * Inputs:
- *     urb -> pointer to USB request block
- *    regs -> pointer to register-buffer for syscalls (see asm/ptrace.h)
+ * acxusb_process_rx()
  *
- * This function is invoked by USB subsystem whenever a bulk receive
- * request returns.
- * The received data is then committed to the network stack and the next
- * USB receive is triggered.
+ * Hand the frames and tx status reports in a completed bulk-in
+ * transfer to the rest of the driver.
  */
-static void acxusb_poll_rx(acx_device_t * adev, usb_rx_t * rx);
-static void acxusb_complete_rx(struct urb *urb)
+static void acxusb_process_rx(acx_device_t *adev, usb_rx_t *rx)
 {
-	acx_device_t *adev;
+	struct urb *urb = rx->urb;
 	rxbuffer_t *ptr;
 	rxbuffer_t *inbuf;
-	usb_rx_t *rx;
-	int size, remsize, packetsize, rxnum;
+	int size, remsize, packetsize;
 	usb_tx_t *tx;
 	struct sk_buff *skb;
 	struct ieee80211_tx_info *txstatus;
-	// unsigned long flags;
 
-
-
-	BUG_ON(!urb->context);
-
-	rx = (usb_rx_t *) urb->context;
-	adev = rx->adev;
-
-	// OW, 20100613: A urb call-back is done in_interrupt(), therefore
-	// I could image, that no locking is actually required
-	// spin_lock_irqsave(&adev->spinlock, flags);
-
-	/*
-	 * Happens on disconnect or close. Don't play with the urb.
-	 * Don't resubmit it. It will get unlinked by close()
-	 */
-	if (unlikely(!test_bit(ACX_FLAG_HW_UP, &adev->flags))) {
-		log(L_USBRXTX,
-			"acx: rx: device is down, not doing anything\n");
-		return;
-	}
-
-	inbuf = &rx->bulkin;
+	inbuf = page_address(rx->page);
 	size = urb->actual_length;
 	remsize = size;
-	rxnum = rx - adev->usb_rx;
 
 	log(L_USBRXTX, "acxusb: RETURN RX (%d) status=%d size=%d\n",
-		rxnum, urb->status, size);
-
-	/* Send the URB that's waiting. */
-	log(L_USBRXTX, "acxusb: rxnum=%d, sending=%d\n",
-		rxnum, rxnum ^ 1);
-	acxusb_poll_rx(adev, &adev->usb_rx[rxnum ^ 1]);
+		(int)(rx - adev->usb_rx), urb->status, size);
 
 	if (unlikely(size > sizeof(rxbuffer_t)))
 		log(L_USBRXTX, "acxusb: rx too large: %d, please report\n", size);
@@ -999,14 +972,24 @@ static void acxusb_complete_rx(struct urb *urb)
 			txstatus->flags |= IEEE80211_TX_STAT_ACK;
 
 		txstatus->status.rates[0].count = stat->ack_failures + 1;
-
-		// report upstream
-		ieee80211_tx_status(adev->hw, skb);
+		acx_tx_count_status(adev, txstatus, stat->ack_failures,
+				stat->rts_failures, stat->rts_ok);
 
 		tx->busy = 0;
 		adev->hw_tx_queue[0].free++;
 
-		if ((adev->hw_tx_queue[0].free >= TX_START_QUEUE) && acx_queue_stopped(adev->hw)) {
+		/* Wakes the queues if the backlog held them */
+		acx_tx_backlog_complete(adev, skb->len,
+			acx_tx_airtime(stat->rate, skb->len,
+				stat->ack_failures + 1));
+
+		// report upstream
+		ieee80211_tx_status(adev->hw, skb);
+
+		/* Restart queue if stopped for the ring */
+		if ((adev->hw_tx_queue[0].free >= TX_START_QUEUE)
+			&& !acx_tx_backlog_full(adev)
+			&& acx_queue_stopped(adev->hw)) {
 			log(L_BUF, "tx: wake queue (avail. Tx desc %u)\n",
 				adev->hw_tx_queue[0].free);
 			acx_wake_queue(adev->hw, NULL);
@@ -1041,8 +1024,8 @@ static void acxusb_complete_rx(struct urb *urb)
 		}
 
 		/* packetsize <= remsize */
-		/* now handle the received data */
-		acx_process_rxbuf(adev, ptr);
+		/* now handle the received data, without a copy */
+		acx_process_rxbuf_page(adev, ptr, rx->page);
 
 		next:
 		ptr = (rxbuffer_t *) (((char *)ptr) + packetsize);
@@ -1057,14 +1040,108 @@ static void acxusb_complete_rx(struct urb *urb)
 
 }
 
+/*
+ * acxusb_i_complete_rx()
+ * Inputs:
+ *     urb -> pointer to USB request block
+ *    regs -> pointer to register-buffer for syscalls (see asm/ptrace.h)
+ *
+ * This function is invoked by USB subsystem whenever a bulk receive
+ * request returns.
+ *
+ * usb_rx_cnt transfers are kept queued on the bulk-in pipe, so the
+ * device has a buffer while we process one. The urbs are handled in
+ * the order they were submitted (which is the order the usb core
+ * completes them on one pipe, but a reordered completion just waits
+ * for its turn): processed, then resubmitted at the tail. This keeps
+ * the frames, and the truncated frame handling across transfers, in
+ * order.
+ *
+ * The slot states, usb_rx_head and usb_rx_started are under
+ * usb_rx_lock: acxusb_op_start submits the slots while completions
+ * already run. A slot stays busy while it is processed, outside the
+ * lock.
+ */
+static int acxusb_poll_rx(acx_device_t * adev, usb_rx_t * rx);
+static void acxusb_complete_rx(struct urb *urb)
+{
+	acx_device_t *adev;
+	usb_rx_t *rx;
+	unsigned long flags;
+	unsigned int n;
+
+	BUG_ON(!urb->context);
+
+	rx = (usb_rx_t *) urb->context;
+	adev = rx->adev;
+
+	/*
+	 * Happens on disconnect or close. Don't play with the urb.
+	 * Don't resubmit it. It will get unlinked by close()
+	 */
+	if (unlikely(!test_bit(ACX_FLAG_HW_UP, &adev->flags))) {
+		log(L_USBRXTX,
+			"acx: rx: device is down, not doing anything\n");
+		return;
+	}
+
+	/* The usb core unanchors the urb before calling us: if the
+	 * anchor is empty, the device had no buffer left to fill */
+	if (usb_anchor_empty(&adev->usb_rx_anchor))
+		adev->usb_rx_starved++;
+
+	spin_lock_irqsave(&adev->usb_rx_lock, flags);
+
+	rx->done = 1;
+
+	for (n = 0; n < adev->usb_rx_cnt; n++) {
+		rx = &adev->usb_rx[adev->usb_rx_head];
+
+		/* Still in flight: the later ones wait for it */
+		if (rx->busy && !rx->done)
+			break;
+
+		/* Not handed out yet, acxusb_op_start submits it */
+		if (!rx->busy && !rx->done
+			&& adev->usb_rx_head >= adev->usb_rx_started)
+			break;
+
+		if (rx->done) {
+			rx->done = 0;
+			spin_unlock_irqrestore(&adev->usb_rx_lock, flags);
+
+			acxusb_process_rx(adev, rx);
+
+			spin_lock_irqsave(&adev->usb_rx_lock, flags);
+			rx->busy = 0;
+
+			/* unlinked, or the device is gone */
+			switch (rx->urb->status) {
+			case -ECONNRESET:
+			case -ENOENT:
+			case -ESHUTDOWN:
+				goto out;
+			}
+		}
+
+		/* Resubmit at the tail. Slots whose last submission
+		 * failed are retried here, in their turn */
+		acxusb_poll_rx(adev, rx);
+		adev->usb_rx_head = (adev->usb_rx_head + 1) % adev->usb_rx_cnt;
+	}
+out:
+	spin_unlock_irqrestore(&adev->usb_rx_lock, flags);
+}
+
 /*
  * acxusb_poll_rx
  * This function (re)initiates a bulk-in USB transfer on a given urb
  */
-static void acxusb_poll_rx(acx_device_t * adev, usb_rx_t * rx)
+static int acxusb_poll_rx(acx_device_t * adev, usb_rx_t * rx)
 {
 	struct usb_device *usbdev;
 	struct urb *rxurb;
+	struct page *page;
 	int errcode, rxnum;
 	unsigned int inpipe;
 
@@ -1084,23 +1161,45 @@ static void acxusb_poll_rx(acx_device_t * adev, usb_rx_t * rx)
 		usb_unlink_urb(rxurb);
 	} else if (unlikely(rxurb->status == -ECONNRESET)) {
 		log(L_USBRXTX, "_poll_rx: connection reset\n");
-		return;
+		return -ECONNRESET;
+	}
+
+	/* Skbs with frames from the last transfer still hold the
+	 * page: leave it to them and take a new one */
+	if (page_count(rx->page) != 1) {
+		page = alloc_pages(GFP_ATOMIC, RXBUF_ORDER);
+		if (unlikely(!page)) {
+			pr_acx("rx urb %d: no memory for a page\n", rxnum);
+			return -ENOMEM;
+		}
+		__free_pages(rx->page, RXBUF_ORDER);
+		rx->page = page;
 	}
+
 	rxurb->actual_length = 0;
-	usb_fill_bulk_urb(rxurb, usbdev, inpipe, &rx->bulkin,	/* dataptr */
+	usb_fill_bulk_urb(rxurb, usbdev, inpipe, page_address(rx->page),	/* dataptr */
 			  RXBUFSIZE,	/* size */
 			  acxusb_complete_rx,	/* handler */
 			  rx	/* handler param */
 	    );
 	rxurb->transfer_flags = URB_ASYNC_UNLINK;
 
+	/* Busy before the submit: it may complete right away */
+	rx->busy = 1;
+
 	/* ATOMIC: we may be called from complete_rx() usb callback */
+	usb_anchor_urb(rxurb, &adev->usb_rx_anchor);
 	errcode = usb_submit_urb(rxurb, GFP_ATOMIC);
-	/* FIXME: evaluate the error code! */
+	if (unlikely(errcode)) {
+		rx->busy = 0;
+		usb_unanchor_urb(rxurb);
+		pr_acx("rx urb %d submit failed: %d\n", rxnum, errcode);
+	}
 	log(L_USBRXTX,
 		"acx: SUBMIT RX (%d) inpipe=0x%X size=%d errcode=%d\n",
 		rxnum, inpipe, (int)RXBUFSIZE, errcode);
 
+	return errcode;
 }
 
 /*
@@ -1261,9 +1360,11 @@ void acxusb_tx_data(acx_device_t *adev, tx_t *tx_opaque, int wlanpkt_len,
 	txbuf->hostdata = (u32) txnum;
 
 	txbuf->ctrl1 = DESC_CTL_FIRSTFRAG;
-	if (1 == adev->preamble_cur)
+	if (adev->preamble_cur && rate_100 != RATE100_1)
 		SET_BIT(txbuf->ctrl1, DESC_CTL_SHORT_PREAMBLE);
 	txbuf->ctrl2 = 0;
+	if (acx_tx_use_rts(adev, ieeectl, 0, skb))
+		SET_BIT(txbuf->ctrl2, DESC_CTL2_RTS);
 	txbuf->data_len = cpu_to_le16(wlanpkt_len);
 
 	if (unlikely(acx_debug & L_DATA)) {
@@ -1403,6 +1504,7 @@ void acxusb_irq_work(struct work_struct *work)
 static int acxusb_op_start(struct ieee80211_hw *hw)
 {
 	acx_device_t *adev = hw2adev(hw);
+	unsigned long flags;
 	int i;
 
 	acx_sem_lock(adev);
@@ -1410,10 +1512,14 @@ static int acxusb_op_start(struct ieee80211_hw *hw)
 	clear_bit(ACX_FLAG_HW_UP, &adev->flags);
 
 	/* Reset URBs status */
-	for (i = 0; i < ACX_RX_URB_CNT; i++) {
+	for (i = 0; i < adev->usb_rx_cnt; i++) {
 		adev->usb_rx[i].urb->status = 0;
 		adev->usb_rx[i].busy = 0;
+		adev->usb_rx[i].done = 0;
 	}
+	adev->usb_rx_head = 0;
+	adev->usb_rx_started = 0;
+	adev->rxtruncsize = 0;
 
 	for (i = 0; i < ACX_TX_URB_CNT; i++) {
 		adev->usb_tx[i].urb->status = 0;
@@ -1427,10 +1533,19 @@ static int acxusb_op_start(struct ieee80211_hw *hw)
 	/* acx_start needs it */
 	acx_update_settings(adev);
 
-	acxusb_poll_rx(adev, &adev->usb_rx[0]);
-
+	acx_tx_backlog_reset(adev);
 	set_bit(ACX_FLAG_HW_UP, &adev->flags);
 
+	/* After HW_UP, so an early completion gets resubmitted. The
+	 * completions leave the slots not submitted yet to us, a slot
+	 * whose submit failed is retried by them in its turn */
+	for (i = 0; i < adev->usb_rx_cnt; i++) {
+		spin_lock_irqsave(&adev->usb_rx_lock, flags);
+		acxusb_poll_rx(adev, &adev->usb_rx[i]);
+		adev->usb_rx_started = i + 1;
+		spin_unlock_irqrestore(&adev->usb_rx_lock, flags);
+	}
+
 	acx_wake_queue(adev->hw, NULL);
 
 	acx_sem_unlock(adev);
@@ -1478,9 +1593,10 @@ static void acxusb_op_stop(struct ieee80211_hw *hw)
 		acxusb_unlink_urb(adev->usb_tx[i].urb);
 		adev->usb_tx[i].busy = 0;
 	}
-	for (i = 0; i < ACX_RX_URB_CNT; i++) {
-		acxusb_unlink_urb(adev->usb_rx[i].urb);
+	usb_kill_anchored_urbs(&adev->usb_rx_anchor);
+	for (i = 0; i < adev->usb_rx_cnt; i++) {
 		adev->usb_rx[i].busy = 0;
+		adev->usb_rx[i].done = 0;
 	}
 	adev->hw_tx_queue[0].free = ACX_TX_URB_CNT;
 
@@ -1495,6 +1611,9 @@ static void acxusb_op_stop(struct ieee80211_hw *hw)
 
 static const struct ieee80211_ops acxusb_hw_ops = {
 	.tx = acx_op_tx,
+#if ACX_TXQ
+	.wake_tx_queue = acx_op_wake_tx_queue,
+#endif
 	.conf_tx = acx_conf_tx,
 	.add_interface = acx_op_add_interface,
 	.remove_interface = acx_op_remove_interface,
@@ -1505,6 +1624,7 @@ static const struct ieee80211_ops acxusb_hw_ops = {
 	.bss_info_changed = acx_op_bss_info_changed,
 	.set_key = acx_op_set_key,
 	.get_stats = acx_op_get_stats,
+	.set_rts_threshold = acx_op_set_rts_threshold,
 #if CONFIG_ACX_MAC80211_VERSION < KERNEL_VERSION(2, 6, 34)
 	.get_tx_stats = acx_e_op_get_tx_stats,
 #endif
@@ -1682,14 +1802,18 @@ acxusb_probe(struct usb_interface *intf, const struct usb_device_id *devID)
 		msg = "acx: no memory for tx container";
 		goto end_nomem;
 	}
-	adev->usb_rx = kmalloc(sizeof(usb_rx_t) * ACX_RX_URB_CNT, GFP_KERNEL);
+	adev->usb_rx_cnt = clamp_t(unsigned int, acx_usb_rx_urbs,
+				ACX_RX_URB_MIN, ACX_RX_URB_MAX);
+	init_usb_anchor(&adev->usb_rx_anchor);
+	spin_lock_init(&adev->usb_rx_lock);
+	adev->usb_rx = kcalloc(adev->usb_rx_cnt, sizeof(usb_rx_t), GFP_KERNEL);
 	if (!adev->usb_rx) {
 		msg = "acx: no memory for rx container";
 		goto end_nomem;
 	}
 
 	/* Setup URBs for bulk-in/out messages */
-	for (i = 0; i < ACX_RX_URB_CNT; i++) {
+	for (i = 0; i < adev->usb_rx_cnt; i++) {
 		adev->usb_rx[i].urb = usb_alloc_urb(0, GFP_KERNEL);
 		if (!adev->usb_rx[i].urb) {
 			msg = "acx: no memory for input URB\n";
@@ -1698,6 +1822,12 @@ acxusb_probe(struct usb_interface *intf, const struct usb_device_id *devID)
 		adev->usb_rx[i].urb->status = 0;
 		adev->usb_rx[i].adev = adev;
 		adev->usb_rx[i].busy = 0;
+
+		adev->usb_rx[i].page = alloc_pages(GFP_KERNEL, RXBUF_ORDER);
+		if (!adev->usb_rx[i].page) {
+			msg = "acx: no memory for rx buffer\n";
+			goto end_nomem;
+		}
 	}
 
 	for (i = 0; i < ACX_TX_URB_CNT; i++) {
@@ -1761,8 +1891,12 @@ acxusb_probe(struct usb_interface *intf, const struct usb_device_id *devID)
 
 	if (hw) {
 		if (adev->usb_rx) {
-			for (i = 0; i < ACX_RX_URB_CNT; i++)
+			for (i = 0; i < adev->usb_rx_cnt; i++) {
 				usb_free_urb(adev->usb_rx[i].urb);
+				if (adev->usb_rx[i].page)
+					__free_pages(adev->usb_rx[i].page,
+						RXBUF_ORDER);
+			}
 			kfree(adev->usb_rx);
 		}
 		if (adev->usb_tx) {
@@ -1826,8 +1960,10 @@ static void acxusb_disconnect(struct usb_interface *intf)
 	 * Here we only free them. _close() took care of
 	 * unlinking them.
 	 */
-	for (i = 0; i < ACX_RX_URB_CNT; ++i) {
+	for (i = 0; i < adev->usb_rx_cnt; ++i) {
 		usb_free_urb(adev->usb_rx[i].urb);
+		/* Skbs may still hold it */
+		__free_pages(adev->usb_rx[i].page, RXBUF_ORDER);
 	}
 	for (i = 0; i < ACX_TX_URB_CNT; ++i) {
 		usb_free_urb(adev->usb_tx[i].urb);
@@ -40,8 +40,9 @@ static void dump_device_descriptor(struct usb_device_descriptor *dd);
 #endif
 
 /* Rx Path
+ * static void acxusb_process_rx(acx_device_t *adev, usb_rx_t *rx);
  * static void acxusb_complete_rx(struct urb *);
- * static void acxusb_poll_rx(acx_device_t * adev, usb_rx_t * rx);
+ * static int acxusb_poll_rx(acx_device_t * adev, usb_rx_t * rx);
  */
 
 /* Tx Path */